@@ -0,0 +1,488 @@
+#include "assembler.hpp"
+#include "endian.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+// .ghcb files store GhcInstruction as is
+static_assert(sizeof(GhcInstruction) == 10 && is_standard_layout<GhcInstruction>::value,
+    "GhcInstruction no longer matches the .ghcb record layout");
+
+static const size_t HEADER_SIZE = 16;
+static const int MAX_LABELS = 256;
+static const int MAX_FIXUPS = 3 * GHC_MAX_PROGRAM_SIZE;
+
+static constexpr uint32_t mnemonicKey(char a, char b, char c)
+{
+    return (uint32_t)a << 16 | (uint32_t)b << 8 | (uint32_t)c;
+}
+
+static const int operandCounts[] =
+{
+    2, 1, 1, 2, 2, 2, 2, 2,
+    2, 2, 3, 3, 3, 1, 0
+};
+
+static char lower(char c)
+{
+    return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+static bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool isWordStart(char c)
+{
+    c = lower(c);
+    return (c >= 'a' && c <= 'z') || c == '_';
+}
+
+static bool isWordChar(char c)
+{
+    return isWordStart(c) || isDigit(c);
+}
+
+static bool sameWord(const char* a, int aLength, const char* b, int bLength)
+{
+    if(aLength != bLength)
+    {
+        return false;
+    }
+
+    for(auto i = 0; i < aLength; i++)
+    {
+        if(lower(a[i]) != lower(b[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Single-pass assembler; label references are patched once the whole
+// source has been read
+class Assembler
+{
+public:
+    Assembler(const char* source, size_t size, GhcInstruction* code) :
+        _pos(source),
+        _end(source + size),
+        _code(code),
+        _size(0),
+        _line(1),
+        _labelCount(0),
+        _fixupCount(0)
+    {
+    }
+
+    int run()
+    {
+        while(_pos < _end)
+        {
+            assembleLine();
+        }
+
+        for(auto i = 0; i < _fixupCount; i++)
+        {
+            resolve(_fixups[i]);
+        }
+
+        return _size;
+    }
+
+private:
+    struct Label
+    {
+        const char* name;
+        int length;
+        int pc;
+    };
+
+    struct Fixup
+    {
+        const char* name;
+        int length;
+        int line;
+        GhcArgument* arg;
+    };
+
+    [[noreturn]] void fail(int line, const string& message) const
+    {
+        throw runtime_error("line " + to_string(line) + ": " + message);
+    }
+
+    [[noreturn]] void fail(const string& message) const
+    {
+        fail(_line, message);
+    }
+
+    char peek() const
+    {
+        return _pos < _end ? *_pos : '\n';
+    }
+
+    bool atEndOfLine() const
+    {
+        return peek() == '\n' || peek() == ';';
+    }
+
+    void skipBlanks()
+    {
+        while(_pos < _end && (*_pos == ' ' || *_pos == '\t' || *_pos == '\r'))
+        {
+            _pos++;
+        }
+    }
+
+    int readWord()
+    {
+        auto start = _pos;
+
+        while(_pos < _end && isWordChar(*_pos))
+        {
+            _pos++;
+        }
+
+        return _pos - start;
+    }
+
+    void finishLine()
+    {
+        skipBlanks();
+
+        if(!atEndOfLine())
+        {
+            fail("unexpected '" + string(1, peek()) + "'");
+        }
+
+        while(_pos < _end && *_pos != '\n')
+        {
+            _pos++;
+        }
+
+        if(_pos < _end)
+        {
+            _pos++;
+        }
+
+        _line++;
+    }
+
+    void assembleLine()
+    {
+        skipBlanks();
+
+        while(!atEndOfLine())
+        {
+            auto word = _pos;
+
+            if(!isWordStart(*word))
+            {
+                fail("unexpected '" + string(1, *word) + "'");
+            }
+
+            auto length = readWord();
+            skipBlanks();
+
+            if(peek() == ':')
+            {
+                _pos++;
+                defineLabel(word, length);
+                skipBlanks();
+                continue;
+            }
+
+            assembleInstruction(word, length);
+            break;
+        }
+
+        finishLine();
+    }
+
+    void assembleInstruction(const char* mnemonic, int length)
+    {
+        if(_size == GHC_MAX_PROGRAM_SIZE)
+        {
+            fail("program longer than " + to_string(GHC_MAX_PROGRAM_SIZE) + " instructions");
+        }
+
+        auto none = GhcArgument {false, false, 0};
+        auto& instr = _code[_size];
+        instr = {parseOpcode(mnemonic, length), none, none, none};
+
+        GhcArgument* args[] = {&instr.arg1, &instr.arg2, &instr.arg3};
+        auto count = operandCounts[(int)instr.opcode];
+
+        for(auto i = 0; i < count; i++)
+        {
+            if(i > 0 && peek() == ',')
+            {
+                _pos++;
+                skipBlanks();
+            }
+
+            if(atEndOfLine())
+            {
+                fail(string(mnemonic, length) + " takes " + to_string(count) + " operands");
+            }
+
+            parseOperand(*args[i]);
+            skipBlanks();
+        }
+
+        if(!atEndOfLine())
+        {
+            fail(string(mnemonic, length) + " takes " + to_string(count) + " operands");
+        }
+
+        _size++;
+    }
+
+    GhcOpcode parseOpcode(const char* mnemonic, int length) const
+    {
+        auto key = uint32_t {0};
+
+        if(length == 2 || length == 3)
+        {
+            key = mnemonicKey(lower(mnemonic[0]), lower(mnemonic[1]), length == 3 ? lower(mnemonic[2]) : '\0');
+        }
+
+        switch(key)
+        {
+            case mnemonicKey('m', 'o', 'v'): return GhcOpcode::MOV;
+            case mnemonicKey('i', 'n', 'c'): return GhcOpcode::INC;
+            case mnemonicKey('d', 'e', 'c'): return GhcOpcode::DEC;
+            case mnemonicKey('a', 'd', 'd'): return GhcOpcode::ADD;
+            case mnemonicKey('s', 'u', 'b'): return GhcOpcode::SUB;
+            case mnemonicKey('m', 'u', 'l'): return GhcOpcode::MUL;
+            case mnemonicKey('d', 'i', 'v'): return GhcOpcode::DIV;
+            case mnemonicKey('a', 'n', 'd'): return GhcOpcode::AND;
+            case mnemonicKey('o', 'r', '\0'): return GhcOpcode::OR;
+            case mnemonicKey('x', 'o', 'r'): return GhcOpcode::XOR;
+            case mnemonicKey('j', 'l', 't'): return GhcOpcode::JLT;
+            case mnemonicKey('j', 'e', 'q'): return GhcOpcode::JEQ;
+            case mnemonicKey('j', 'g', 't'): return GhcOpcode::JGT;
+            case mnemonicKey('i', 'n', 't'): return GhcOpcode::INT;
+            case mnemonicKey('h', 'l', 't'): return GhcOpcode::HLT;
+        }
+
+        fail("unknown opcode '" + string(mnemonic, length) + "'");
+    }
+
+    void parseOperand(GhcArgument& arg)
+    {
+        if(peek() == '[')
+        {
+            arg.isIndirect = true;
+            _pos++;
+            skipBlanks();
+        }
+
+        if(isDigit(peek()))
+        {
+            auto value = 0;
+
+            while(_pos < _end && isDigit(*_pos))
+            {
+                value = value * 10 + (*_pos++ - '0');
+
+                if(value > 255)
+                {
+                    fail("constant out of range");
+                }
+            }
+
+            arg.value = value;
+        }
+        else if(isWordStart(peek()))
+        {
+            auto word = _pos;
+            auto length = readWord();
+            auto c = lower(word[0]);
+
+            if(length == 1 && c >= 'a' && c <= 'h')
+            {
+                arg.isRegister = true;
+                arg.value = c - 'a' + 1;
+            }
+            else if(sameWord(word, length, "pc", 2))
+            {
+                arg.isRegister = true;
+                arg.value = 0;
+            }
+            else
+            {
+                if(_fixupCount == MAX_FIXUPS)
+                {
+                    fail("too many label references");
+                }
+
+                _fixups[_fixupCount++] = Fixup {word, length, _line, &arg};
+            }
+        }
+        else
+        {
+            fail("bad operand");
+        }
+
+        if(arg.isIndirect)
+        {
+            skipBlanks();
+
+            if(peek() != ']')
+            {
+                fail("missing ']'");
+            }
+
+            _pos++;
+        }
+    }
+
+    void defineLabel(const char* name, int length)
+    {
+        auto c = lower(name[0]);
+
+        if((length == 1 && c >= 'a' && c <= 'h') || sameWord(name, length, "pc", 2))
+        {
+            fail("label '" + string(name, length) + "' is a register name");
+        }
+
+        if(findLabel(name, length))
+        {
+            fail("label '" + string(name, length) + "' already defined");
+        }
+
+        if(_labelCount == MAX_LABELS)
+        {
+            fail("too many labels");
+        }
+
+        _labels[_labelCount++] = Label {name, length, _size};
+    }
+
+    const Label* findLabel(const char* name, int length) const
+    {
+        for(auto i = 0; i < _labelCount; i++)
+        {
+            if(sameWord(_labels[i].name, _labels[i].length, name, length))
+            {
+                return &_labels[i];
+            }
+        }
+
+        return nullptr;
+    }
+
+    void resolve(const Fixup& fixup) const
+    {
+        auto label = findLabel(fixup.name, fixup.length);
+
+        if(!label)
+        {
+            fail(fixup.line, "undefined label '" + string(fixup.name, fixup.length) + "'");
+        }
+
+        if(label->pc > 255)
+        {
+            fail(fixup.line, "label '" + string(fixup.name, fixup.length) + "' out of range");
+        }
+
+        fixup.arg->value = label->pc;
+    }
+
+    const char* _pos;
+    const char* _end;
+    GhcInstruction* _code;
+    int _size;
+    int _line;
+    Label _labels[MAX_LABELS];
+    int _labelCount;
+    Fixup _fixups[MAX_FIXUPS];
+    int _fixupCount;
+};
+
+int assembleProgram(const char* source, size_t size, GhcInstruction* code)
+{
+    return Assembler(source, size, code).run();
+}
+
+vector<GhcInstruction> parseProgram(istream& is)
+{
+    if(!is)
+    {
+        throw runtime_error("bad input stream");
+    }
+
+    auto source = string(istreambuf_iterator<char>(is), istreambuf_iterator<char>());
+    auto code = vector<GhcInstruction>(GHC_MAX_PROGRAM_SIZE);
+    code.resize(assembleProgram(source.data(), source.size(), code.data()));
+
+    return code;
+}
+
+bool isBinaryProgram(const char* data, size_t size)
+{
+    return size >= 4 && memcmp(data, "GHCB", 4) == 0;
+}
+
+const GhcInstruction* readBinaryProgram(const char* data, size_t size, GhcBinaryHeader& header)
+{
+    if(!isBinaryProgram(data, size) || size < HEADER_SIZE)
+    {
+        throw runtime_error("not a binary ghost program");
+    }
+
+    memcpy(header.magic, data, 4);
+    header.version = readLittleEndian(data + 4, 2);
+    header.size = readLittleEndian(data + 6, 2);
+    header.sourceHash = readLittleEndian(data + 8, 8);
+
+    if(header.version != GHC_BINARY_VERSION)
+    {
+        throw runtime_error("unsupported binary ghost program version " + to_string(header.version));
+    }
+
+    if(header.size > GHC_MAX_PROGRAM_SIZE || size != HEADER_SIZE + header.size * sizeof(GhcInstruction))
+    {
+        throw runtime_error("truncated binary ghost program");
+    }
+
+    // everything has to be a valid GhcInstruction before it is used as one
+    auto bytes = (const uint8_t*)data + HEADER_SIZE;
+
+    for(auto i = 0; i < header.size; i++, bytes += sizeof(GhcInstruction))
+    {
+        if(bytes[0] > (uint8_t)GhcOpcode::HLT)
+        {
+            throw runtime_error("bad opcode in binary ghost program");
+        }
+
+        for(auto arg = bytes + 1; arg < bytes + sizeof(GhcInstruction); arg += 3)
+        {
+            if(arg[0] > 1 || arg[1] > 1 || (arg[1] && arg[2] > 8))
+            {
+                throw runtime_error("bad operand in binary ghost program");
+            }
+        }
+    }
+
+    return (const GhcInstruction*)(data + HEADER_SIZE);
+}
+
+void writeBinaryProgram(ostream& os, const vector<GhcInstruction>& code, uint64_t sourceHash)
+{
+    if(code.size() > GHC_MAX_PROGRAM_SIZE)
+    {
+        throw runtime_error("program longer than " + to_string(GHC_MAX_PROGRAM_SIZE) + " instructions");
+    }
+
+    os.write("GHCB", 4);
+    writeLittleEndian(os, GHC_BINARY_VERSION, 2);
+    writeLittleEndian(os, code.size(), 2);
+    writeLittleEndian(os, sourceHash, 8);
+    os.write((const char*)code.data(), code.size() * sizeof(GhcInstruction));
+}
@@ -0,0 +1,41 @@
+#ifndef LAMCO_ASSEMBLER_HPP
+#define LAMCO_ASSEMBLER_HPP
+
+#include "ghost.hpp"
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+static const int GHC_MAX_PROGRAM_SIZE = 256;
+
+// Assembles GHC source into code, which must have room for
+// GHC_MAX_PROGRAM_SIZE instructions, and returns the instruction count.
+// Makes one pass and allocates nothing unless it throws; errors carry the
+// line number. Labels are defined as "name:" and usable wherever a
+// constant is.
+int assembleProgram(const char* source, size_t size, GhcInstruction* code);
+
+vector<GhcInstruction> parseProgram(istream& is);
+
+// A .ghcb file is this header followed by the instructions, each stored
+// exactly as a GhcInstruction so a mapped file can be read in place
+struct GhcBinaryHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t size;
+    // hash of the source it was assembled from, to find compiled modules
+    uint64_t sourceHash;
+};
+
+static const uint16_t GHC_BINARY_VERSION = 1;
+
+bool isBinaryProgram(const char* data, size_t size);
+// Checks the header and every instruction, returning the instructions
+// inside data
+const GhcInstruction* readBinaryProgram(const char* data, size_t size, GhcBinaryHeader& header);
+void writeBinaryProgram(ostream& os, const vector<GhcInstruction>& code, uint64_t sourceHash);
+
+#endif
@@ -1,8 +1,18 @@
 #!/bin/sh
 set -e
-g++ -std=c++11 -Wall -Wextra -Werror -o lamco \
-   main.cpp \
-   game.cpp \
-   map.cpp \
-   player.cpp \
-   ghost.cpp
+FLAGS="-std=c++11 -Wall -Wextra -Werror -I. -pthread"
+SOURCES="game.cpp checkpoint.cpp replay.cpp events.cpp map.cpp player.cpp ghost.cpp ghostpool.cpp assembler.cpp profile.cpp memo.cpp render.cpp playback.cpp mappedfile.cpp trace.cpp workerpool.cpp lockstep.cpp jit.cpp native.cpp"
+
+# ghost programs translated with ghc2cpp are linked in from compiled/
+MODULES=$(ls compiled/*.cpp 2>/dev/null || true)
+
+g++ $FLAGS -o lamco main.cpp $SOURCES $MODULES
+g++ $FLAGS -o lamco-tournament lamcotournament.cpp tournament.cpp shard.cpp $SOURCES $MODULES
+g++ $FLAGS -o ghc2cpp ghc2cpp.cpp $SOURCES
+g++ $FLAGS -o ghcasm ghcasm.cpp $SOURCES
+g++ $FLAGS -o ghctrace ghctrace.cpp trace.cpp
+g++ $FLAGS -o eventbench eventbench.cpp events.cpp
+
+# games longer than the coordinator's timeout on loopback shard workers;
+# run ./shardtest, which fails if any shard had to be resent
+g++ $FLAGS -o shardtest shardtest.cpp tournament.cpp shard.cpp $SOURCES $MODULES
@@ -0,0 +1,284 @@
+#include "checkpoint.hpp"
+#include "assembler.hpp"
+#include "endian.hpp"
+#include "mappedfile.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+// Reads a checkpoint front to back, throwing if it runs out
+class CheckpointReader
+{
+public:
+    CheckpointReader(const char* data, size_t size) :
+        _data(data),
+        _size(size),
+        _pos(0)
+    {
+    }
+
+    const char* take(size_t bytes)
+    {
+        if(_size - _pos < bytes)
+        {
+            throw runtime_error("truncated checkpoint");
+        }
+
+        auto data = _data + _pos;
+        _pos += bytes;
+
+        return data;
+    }
+
+    uint64_t unsignedValue(int bytes)
+    {
+        return readLittleEndian(take(bytes), bytes);
+    }
+
+    int intValue()
+    {
+        return (int32_t)unsignedValue(4);
+    }
+
+    // A value of at most max
+    int limited(int bytes, int max)
+    {
+        auto value = unsignedValue(bytes);
+
+        if(value > (uint64_t)max)
+        {
+            throw runtime_error("bad checkpoint");
+        }
+
+        return (int)value;
+    }
+
+    bool done() const
+    {
+        return _pos == _size;
+    }
+
+private:
+    const char* _data;
+    size_t _size;
+    size_t _pos;
+};
+
+static void writePosition(ostream& os, Position pos)
+{
+    writeLittleEndian(os, pos.x, 1);
+    writeLittleEndian(os, pos.y, 1);
+}
+
+// Map squares are at most 255 from the origin, see Map::validate
+static Position readPosition(CheckpointReader& reader, const Map& map)
+{
+    auto x = reader.limited(1, map.width() - 1);
+    auto y = reader.limited(1, map.height() - 1);
+
+    return Position {x, y};
+}
+
+static Direction readDirection(CheckpointReader& reader)
+{
+    return (Direction)reader.limited(1, (int)Direction::LEFT);
+}
+
+void writeCheckpoint(ostream& os, const GameCheckpoint& checkpoint)
+{
+    auto& map = checkpoint.originalMap;
+
+    os.write("LMCP", 4);
+    writeLittleEndian(os, GAME_CHECKPOINT_VERSION, 2);
+
+    writeLittleEndian(os, map.width(), 2);
+    writeLittleEndian(os, map.height(), 2);
+
+    for(auto y = 0; y < map.height(); y++)
+    {
+        os.write(map.row(y), map.width());
+    }
+
+    writeLittleEndian(os, checkpoint.changedSquares.size(), 4);
+
+    for(auto& change : checkpoint.changedSquares)
+    {
+        writePosition(os, change.pos);
+        os.put(change.square);
+    }
+
+    writeLittleEndian(os, checkpoint.clock.value, 4);
+    writeLittleEndian(os, checkpoint.lastClock.value, 4);
+    writePosition(os, checkpoint.fruitPos);
+    writeLittleEndian(os, checkpoint.lives, 4);
+    writeLittleEndian(os, checkpoint.score, 4);
+    writeLittleEndian(os, checkpoint.ghostValue, 4);
+    writeLittleEndian(os, checkpoint.frames, 4);
+
+    writePosition(os, checkpoint.playerStartPos);
+    writePosition(os, checkpoint.playerPos);
+    writeLittleEndian(os, (int)checkpoint.playerDirection, 1);
+
+    writeLittleEndian(os, checkpoint.programs.size(), 2);
+
+    for(auto& program : checkpoint.programs)
+    {
+        ostringstream binary;
+        writeBinaryProgram(binary, program->code(), program->hash());
+        writeLittleEndian(os, binary.str().size(), 4);
+        os << binary.str();
+    }
+
+    writeLittleEndian(os, checkpoint.ghosts.size(), 2);
+
+    for(auto& ghost : checkpoint.ghosts)
+    {
+        writeLittleEndian(os, ghost.program, 2);
+        writePosition(os, ghost.startPos);
+        writePosition(os, ghost.pos);
+        writeLittleEndian(os, (int)ghost.direction, 1);
+        writeLittleEndian(os, ghost.invisible, 1);
+        os.write((const char*)ghost.registers, sizeof(ghost.registers));
+        os.write((const char*)ghost.data, sizeof(ghost.data));
+    }
+
+    writeLittleEndian(os, checkpoint.events.size(), 4);
+
+    for(auto& event : checkpoint.events)
+    {
+        writeLittleEndian(os, (int)event.type, 1);
+        writeLittleEndian(os, event.clock.value, 4);
+        writeLittleEndian(os, event.arg, 4);
+    }
+}
+
+void writeCheckpoint(const string& path, const GameCheckpoint& checkpoint)
+{
+    auto temporary = path + ".tmp";
+
+    {
+        ofstream os(temporary, ios::binary);
+
+        if(!os)
+        {
+            throw runtime_error("bad checkpoint stream");
+        }
+
+        writeCheckpoint(os, checkpoint);
+
+        if(!os.flush())
+        {
+            throw runtime_error("bad checkpoint stream");
+        }
+    }
+
+    if(rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        throw runtime_error("bad checkpoint stream");
+    }
+}
+
+GameCheckpoint readCheckpoint(const char* data, size_t size)
+{
+    CheckpointReader reader(data, size);
+    auto checkpoint = GameCheckpoint();
+
+    if(size < 4 || memcmp(reader.take(4), "LMCP", 4) != 0)
+    {
+        throw runtime_error("not a checkpoint");
+    }
+
+    auto version = reader.unsignedValue(2);
+
+    if(version != GAME_CHECKPOINT_VERSION)
+    {
+        throw runtime_error("unsupported checkpoint version " + to_string(version));
+    }
+
+    auto width = reader.limited(2, 256);
+    auto height = reader.limited(2, 256);
+
+    {
+        // the text a map file would hold, checked the same way
+        string text;
+
+        for(auto y = 0; y < height; y++)
+        {
+            text.append(reader.take(width), width);
+            text += '\n';
+        }
+
+        istringstream is(text);
+        checkpoint.originalMap.init(is);
+    }
+
+    auto& map = checkpoint.originalMap;
+    checkpoint.changedSquares.resize(reader.limited(4, width * height));
+
+    for(auto& change : checkpoint.changedSquares)
+    {
+        change.pos = readPosition(reader, map);
+        change.square = *reader.take(1);
+    }
+
+    checkpoint.clock = Clock {reader.intValue()};
+    checkpoint.lastClock = Clock {reader.intValue()};
+    checkpoint.fruitPos = readPosition(reader, map);
+    checkpoint.lives = reader.intValue();
+    checkpoint.score = reader.intValue();
+    checkpoint.ghostValue = reader.intValue();
+    checkpoint.frames = reader.intValue();
+
+    checkpoint.playerStartPos = readPosition(reader, map);
+    checkpoint.playerPos = readPosition(reader, map);
+    checkpoint.playerDirection = readDirection(reader);
+
+    checkpoint.programs.resize(reader.limited(2, 256));
+
+    for(auto& program : checkpoint.programs)
+    {
+        auto size = reader.limited(4, 1 << 20);
+        auto data = reader.take(size);
+        GhcBinaryHeader header;
+        auto code = readBinaryProgram(data, size, header);
+        program = make_shared<GhcProgram>(vector<GhcInstruction>(code, code + header.size), header.sourceHash);
+    }
+
+    checkpoint.ghosts.resize(reader.limited(2, 256));
+
+    for(auto& ghost : checkpoint.ghosts)
+    {
+        ghost.program = reader.limited(2, (int)checkpoint.programs.size() - 1);
+        ghost.startPos = readPosition(reader, map);
+        ghost.pos = readPosition(reader, map);
+        ghost.direction = readDirection(reader);
+        ghost.invisible = reader.limited(1, 1);
+        memcpy(ghost.registers, reader.take(sizeof(ghost.registers)), sizeof(ghost.registers));
+        memcpy(ghost.data, reader.take(sizeof(ghost.data)), sizeof(ghost.data));
+    }
+
+    checkpoint.events.resize(reader.limited(4, 1 << 20));
+
+    for(auto& event : checkpoint.events)
+    {
+        event.type = (EventType)reader.limited(1, (int)EventType::FRIGHT_MODE_EXPIRES);
+        event.clock = Clock {reader.limited(4, numeric_limits<int32_t>::max())};
+        event.arg = reader.limited(4, (1 << 24) - 1);
+    }
+
+    if(!reader.done())
+    {
+        throw runtime_error("bad checkpoint");
+    }
+
+    return checkpoint;
+}
+
+GameCheckpoint readCheckpoint(const string& path)
+{
+    MappedFile file(path);
+    return readCheckpoint(file.data(), file.size());
+}
@@ -0,0 +1,70 @@
+#ifndef LAMCO_CHECKPOINT_HPP
+#define LAMCO_CHECKPOINT_HPP
+
+#include "basic.hpp"
+#include "events.hpp"
+#include "ghost.hpp"
+#include "map.hpp"
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const uint16_t GAME_CHECKPOINT_VERSION = 1;
+
+struct GameCheckpointSquare
+{
+    Position pos;
+    char square;
+};
+
+struct GameCheckpointGhost
+{
+    // index into GameCheckpoint::programs
+    int program;
+    Position startPos;
+    Position pos;
+    Direction direction;
+    bool invisible;
+    uint8_t registers[9];
+    uint8_t data[GHC_DATA_SIZE];
+};
+
+// Everything a game needs to carry on from between two ticks. Checkpoint
+// files hold the programs as .ghcb, so resuming never assembles source,
+// and the map as loaded plus the squares that have changed since.
+struct GameCheckpoint
+{
+    Map originalMap;
+    vector<GameCheckpointSquare> changedSquares;
+
+    Clock clock;
+    Clock lastClock;
+    Position fruitPos;
+    int lives;
+    int score;
+    int ghostValue;
+    // frames rendered or skipped, so render every n-th frame carries on
+    int frames;
+
+    Position playerStartPos;
+    Position playerPos;
+    Direction playerDirection;
+
+    vector<shared_ptr<const GhcProgram>> programs;
+    vector<GameCheckpointGhost> ghosts;
+    vector<Event> events;
+};
+
+// Checkpoints are little-endian whatever the host. Writing to a path goes
+// to a temporary file renamed over it, so an interrupted write leaves the
+// last checkpoint intact.
+void writeCheckpoint(ostream& os, const GameCheckpoint& checkpoint);
+void writeCheckpoint(const string& path, const GameCheckpoint& checkpoint);
+GameCheckpoint readCheckpoint(const char* data, size_t size);
+GameCheckpoint readCheckpoint(const string& path);
+
+#endif
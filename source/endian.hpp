@@ -0,0 +1,32 @@
+#ifndef LAMCO_ENDIAN_HPP
+#define LAMCO_ENDIAN_HPP
+
+#include <cstdint>
+#include <ostream>
+
+using namespace std;
+
+// The file formats (.ghcb, checkpoints, replays, traces) store integers
+// little endian in a fixed number of bytes
+
+inline uint64_t readLittleEndian(const char* data, int bytes)
+{
+    auto value = uint64_t {0};
+
+    for(auto i = bytes - 1; i >= 0; i--)
+    {
+        value = value << 8 | (uint8_t)data[i];
+    }
+
+    return value;
+}
+
+inline void writeLittleEndian(ostream& os, uint64_t value, int bytes)
+{
+    for(auto i = 0; i < bytes; i++)
+    {
+        os.put((char)(value >> (8 * i)));
+    }
+}
+
+#endif
@@ -0,0 +1,132 @@
+#include "events.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+
+// The binary heap EventQueue replaced, kept to measure against
+class HeapQueue
+{
+public:
+    void push(Event event)
+    {
+        _heap.push_back(event);
+        push_heap(_heap.begin(), _heap.end(), Later {});
+    }
+
+    Event pop()
+    {
+        auto event = _heap.front();
+        pop_heap(_heap.begin(), _heap.end(), Later {});
+        _heap.pop_back();
+
+        return event;
+    }
+
+private:
+    struct Later
+    {
+        bool operator()(const Event& a, const Event& b) const
+        {
+            if(a.clock.value != b.clock.value)
+            {
+                return a.clock.value > b.clock.value;
+            }
+
+            if(a.type != b.type)
+            {
+                return a.type > b.type;
+            }
+
+            return a.arg > b.arg;
+        }
+    };
+
+    vector<Event> _heap;
+};
+
+// Replays the events of a game with ghosts moving at their usual speeds
+// until count events have come out, returning a checksum of their order
+template<class Queue>
+static uint64_t simulate(Queue& queue, int ghosts, int count)
+{
+    queue.push(Event {EventType::END_OF_LIVES, {127 * 100000}, 0});
+    queue.push(Event {EventType::FRUIT_APPEARS, {127 * 200}, 0});
+    queue.push(Event {EventType::FRUIT_EXPIRES, {127 * 280}, 0});
+    queue.push(Event {EventType::PLAYER_MOVES, {127}, 0});
+
+    for(auto i = 0; i < ghosts; i++)
+    {
+        queue.push(Event {EventType::GHOST_MOVES, {130 + (i % 4) * 2}, i});
+    }
+
+    auto checksum = uint64_t {0};
+
+    for(auto n = 0; n < count; n++)
+    {
+        auto event = queue.pop();
+        checksum = checksum * 31 + event.clock.value * 7 + (int)event.type * 3 + event.arg;
+
+        switch(event.type)
+        {
+            case EventType::PLAYER_MOVES:
+                queue.push(Event {EventType::PLAYER_MOVES, {event.clock.value + 127 + n % 2 * 10}, 0});
+                break;
+            case EventType::GHOST_MOVES:
+                queue.push(Event {EventType::GHOST_MOVES, {event.clock.value + 130 + (event.arg % 4) * 2}, event.arg});
+                break;
+            default:
+                break;
+        }
+    }
+
+    return checksum;
+}
+
+template<class Queue>
+static double nanosPerEvent(uint64_t& checksum, int ghosts, int count)
+{
+    Queue queue;
+    auto start = chrono::steady_clock::now();
+    checksum = simulate(queue, ghosts, count);
+    auto elapsed = chrono::steady_clock::now() - start;
+
+    return chrono::duration<double, nano>(elapsed).count() / count;
+}
+
+// Times EventQueue against a binary heap on a game's worth of moves
+int main(int argc, char* argv[])
+{
+    try
+    {
+        if(argc > 3)
+        {
+            throw runtime_error("usage: eventbench [ghosts] [events]");
+        }
+
+        auto ghosts = argc > 1 ? atoi(argv[1]) : 256;
+        auto count = argc > 2 ? atoi(argv[2]) : 10000000;
+        auto heapChecksum = uint64_t {};
+        auto wheelChecksum = uint64_t {};
+
+        auto heap = nanosPerEvent<HeapQueue>(heapChecksum, ghosts, count);
+        auto wheel = nanosPerEvent<EventQueue>(wheelChecksum, ghosts, count);
+
+        if(heapChecksum != wheelChecksum)
+        {
+            throw runtime_error("queues disagree on event order");
+        }
+
+        cout << ghosts << " ghosts, " << count << " events\n";
+        cout << "heap:  " << heap << " ns/event\n";
+        cout << "wheel: " << wheel << " ns/event\n";
+    }
+    catch(const runtime_error& e)
+    {
+        cerr << "An error occurred: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,296 @@
+#include "events.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+static const int ARG_BITS = 24;
+
+static uint64_t packEvent(const Event& event)
+{
+    return (uint64_t)event.clock.value << 32 | (uint64_t)event.type << ARG_BITS | (uint64_t)event.arg;
+}
+
+static Event unpackEvent(uint64_t key)
+{
+    return Event {(EventType)(key >> ARG_BITS & 0xFF), Clock {(int)(key >> 32)}, (int)(key & ((1 << ARG_BITS) - 1))};
+}
+
+bool EventQueue::Later::operator()(const Entry& a, const Entry& b) const
+{
+    return a.key > b.key;
+}
+
+EventQueue::EventQueue() :
+    _slots(),
+    _occupied(),
+    _wheelSize(0),
+    _base(0),
+    _now(0),
+    _nextId(1)
+{
+}
+
+EventQueue::EventQueue(const EventQueue& other) :
+    EventQueue()
+{
+    *this = other;
+}
+
+EventQueue& EventQueue::operator=(const EventQueue& other)
+{
+    if(&other == this)
+    {
+        return *this;
+    }
+
+    // a slot that is not occupied is empty, so only these differ
+    for(auto word = 0; word < SLOTS / 64; word++)
+    {
+        auto bits = _occupied[word] | other._occupied[word];
+
+        while(bits != 0)
+        {
+            auto index = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            _slots[index] = other._slots[index];
+        }
+    }
+
+    copy(begin(other._occupied), end(other._occupied), begin(_occupied));
+    _wheelSize = other._wheelSize;
+    _base = other._base;
+    _now = other._now;
+    _overflow = other._overflow;
+    _cancelled = other._cancelled;
+    _nextId = other._nextId;
+
+    return *this;
+}
+
+void EventQueue::clear()
+{
+    for(auto& slot : _slots)
+    {
+        slot.entries.clear();
+        slot.head = 0;
+        slot.unsorted = false;
+    }
+
+    fill(begin(_occupied), end(_occupied), 0);
+    _wheelSize = 0;
+    _base = 0;
+    _now = 0;
+    _overflow.clear();
+    _cancelled.clear();
+}
+
+EventHandle EventQueue::push(Event event)
+{
+    if(event.clock.value < 0 || event.arg < 0 || event.arg >= 1 << ARG_BITS)
+    {
+        throw logic_error("event out of range");
+    }
+
+    auto entry = Entry {packEvent(event), _nextId++};
+    auto clock = event.clock.value;
+
+    // an empty wheel starts over from now
+    if(_wheelSize == 0)
+    {
+        _base = _now;
+    }
+
+    if(clock >= _base && clock - _base < SLOTS)
+    {
+        // the slot at _base is always the earliest
+        if(_wheelSize == 0)
+        {
+            _base = clock;
+        }
+
+        auto index = clock % SLOTS;
+        auto& slot = _slots[index];
+
+        auto& entries = slot.entries;
+
+        if(clock == _base)
+        {
+            entries.insert(upper_bound(entries.begin() + slot.head, entries.end(), entry), entry);
+        }
+        else
+        {
+            if(!entries.empty() && entry < entries.back())
+            {
+                slot.unsorted = true;
+            }
+
+            entries.push_back(entry);
+        }
+
+        _occupied[index / 64] |= uint64_t {1} << index % 64;
+        _wheelSize++;
+    }
+    else
+    {
+        _overflow.push_back(entry);
+        push_heap(_overflow.begin(), _overflow.end(), Later {});
+    }
+
+    return EventHandle {entry.id};
+}
+
+void EventQueue::cancel(EventHandle handle)
+{
+    if(handle.id == 0)
+    {
+        return;
+    }
+
+    _cancelled.insert(handle.id);
+    settle();
+}
+
+bool EventQueue::empty() const
+{
+    return _wheelSize == 0 && _overflow.empty();
+}
+
+Event EventQueue::front() const
+{
+    return unpackEvent(frontEntry().key);
+}
+
+Event EventQueue::pop()
+{
+    auto event = front();
+    _now = max(_now, event.clock.value);
+    dropFront();
+    settle();
+
+    return event;
+}
+
+vector<Event> EventQueue::pending() const
+{
+    auto entries = _overflow;
+
+    for(auto& slot : _slots)
+    {
+        entries.insert(entries.end(), slot.entries.begin() + slot.head, slot.entries.end());
+    }
+
+    sort(entries.begin(), entries.end());
+
+    vector<Event> events;
+
+    for(auto& entry : entries)
+    {
+        if(_cancelled.count(entry.id) == 0)
+        {
+            events.push_back(unpackEvent(entry.key));
+        }
+    }
+
+    return events;
+}
+
+bool EventQueue::frontInWheel() const
+{
+    if(_wheelSize == 0)
+    {
+        return false;
+    }
+
+    auto& slot = _slots[_base % SLOTS];
+    return _overflow.empty() || slot.entries[slot.head] < _overflow.front();
+}
+
+const EventQueue::Entry& EventQueue::frontEntry() const
+{
+    if(frontInWheel())
+    {
+        auto& slot = _slots[_base % SLOTS];
+        return slot.entries[slot.head];
+    }
+
+    return _overflow.front();
+}
+
+void EventQueue::dropFront()
+{
+    if(frontInWheel())
+    {
+        auto index = _base % SLOTS;
+        auto& slot = _slots[index];
+        slot.head++;
+        _wheelSize--;
+
+        if(slot.head == slot.entries.size())
+        {
+            slot.entries.clear();
+            slot.head = 0;
+            slot.unsorted = false;
+            _occupied[index / 64] &= ~(uint64_t {1} << index % 64);
+        }
+    }
+    else
+    {
+        pop_heap(_overflow.begin(), _overflow.end(), Later {});
+        _overflow.pop_back();
+    }
+}
+
+void EventQueue::settle()
+{
+    while(true)
+    {
+        auto index = _base % SLOTS;
+
+        if(_wheelSize > 0 && _slots[index].entries.empty())
+        {
+            // the next occupied slot round from here
+            auto next = index;
+
+            for(auto i = 0; i <= SLOTS / 64; i++)
+            {
+                auto word = (index / 64 + i) % (SLOTS / 64);
+                auto bits = _occupied[word];
+
+                if(i == 0)
+                {
+                    bits &= ~uint64_t {0} << index % 64;
+                }
+
+                if(bits != 0)
+                {
+                    next = word * 64 + __builtin_ctzll(bits);
+                    break;
+                }
+            }
+
+            _base += (next - index + SLOTS) % SLOTS;
+
+            auto& slot = _slots[next];
+
+            if(slot.unsorted)
+            {
+                sort(slot.entries.begin(), slot.entries.end());
+                slot.unsorted = false;
+            }
+        }
+
+        if(_cancelled.empty() || empty())
+        {
+            return;
+        }
+
+        auto it = _cancelled.find(frontEntry().id);
+
+        if(it == _cancelled.end())
+        {
+            return;
+        }
+
+        _cancelled.erase(it);
+        dropFront();
+    }
+}
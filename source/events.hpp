@@ -0,0 +1,116 @@
+#ifndef LAMCO_EVENTS_HPP
+#define LAMCO_EVENTS_HPP
+
+#include <cstdint>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+struct Clock
+{
+    int value;
+};
+
+enum class EventType
+{
+    // Events here occur in the order listed here when on the same tick
+    END_OF_LIVES,
+    PLAYER_MOVES,
+    GHOST_MOVES,
+    FRUIT_APPEARS,
+    FRUIT_EXPIRES,
+    FRIGHT_MODE_EXPIRES
+};
+
+struct Event
+{
+    EventType type;
+    Clock clock;
+    int arg;
+};
+
+// Names a queued event, to cancel it; the default handle names none
+struct EventHandle
+{
+    uint64_t id;
+};
+
+// Events by clock, then type, then arg. Near events go on a timing wheel
+// of one-tick slots, which covers every move, so queueing and popping them
+// is O(1); the rare event outside its window, far ahead or already past,
+// waits in a small heap. Cancelled events stay queued as tombstones until
+// they reach the front, where they are dropped.
+class EventQueue
+{
+public:
+    EventQueue();
+    // Copies touch only the occupied slots of either queue
+    EventQueue(const EventQueue& other);
+    EventQueue& operator=(const EventQueue& other);
+
+    void clear();
+    // Clocks must not be negative, nor args outside [0, 2^24)
+    EventHandle push(Event event);
+    // The event must still be queued; the default handle is ignored
+    void cancel(EventHandle handle);
+
+    bool empty() const;
+    Event front() const;
+    Event pop();
+    // Every event still queued, in the order they would come out
+    vector<Event> pending() const;
+
+private:
+    // longer than the slowest move
+    static const int SLOTS = 256;
+
+    // Sorts as the event does: clock << 32 | type << 24 | arg
+    struct Entry
+    {
+        uint64_t key;
+        uint64_t id;
+
+        bool operator<(const Entry& other) const
+        {
+            return key < other.key;
+        }
+    };
+
+    struct Later
+    {
+        bool operator()(const Entry& a, const Entry& b) const;
+    };
+
+    // Events of one clock. Moves mostly come in the order they go out, so
+    // a slot is only sorted if they didn't.
+    struct Slot
+    {
+        vector<Entry> entries;
+        // where the events still queued start
+        size_t head;
+        bool unsorted;
+    };
+
+    bool frontInWheel() const;
+    const Entry& frontEntry() const;
+    void dropFront();
+    // moves the wheel onto its earliest slot and drops tombstones
+    void settle();
+
+    // Each slot holds one clock; the slot at _base, which is the earliest
+    // unless the wheel is empty, is kept sorted
+    Slot _slots[SLOTS];
+    uint64_t _occupied[SLOTS / 64];
+    int _wheelSize;
+    int _base;
+    // the latest clock to come out
+    int _now;
+    // heap of what is outside [_base, _base + SLOTS) when queued
+    vector<Entry> _overflow;
+
+    unordered_set<uint64_t> _cancelled;
+    uint64_t _nextId;
+};
+
+#endif
@@ -1,35 +1,10 @@
 #include "game.hpp"
+#include <algorithm>
 #include <fstream>
+#include <limits>
+#include <sstream>
 #include <string>
 
-struct EventComparer
-{
-    bool operator()(const Event& a, const Event& b)
-    {
-        if(a.clock.value > b.clock.value)
-        {
-            return true;
-        }
-
-        if(a.clock.value < b.clock.value)
-        {
-            return false;
-        }
-
-        if(a.type > b.type)
-        {
-            return true;
-        }
-
-        if(a.type < b.type)
-        {
-            return false;
-        }
-
-        return a.arg > b.arg;
-    }
-};
-
 static bool operator!=(Clock a, Clock b)
 {
     return a.value != b.value;
@@ -66,9 +41,38 @@ static int getFruitValue(int level)
     return 5000;
 }
 
+const char* gameEndName(GameEnd end)
+{
+    switch(end)
+    {
+        case GameEnd::RUNNING: return "running";
+        case GameEnd::LOST: return "lost";
+        case GameEnd::WON: return "won";
+        case GameEnd::TIMEOUT: return "timeout";
+    }
+
+    return "unknown";
+}
+
+Game::Game() :
+    _end(GameEnd::RUNNING),
+    _headless(false),
+    _renderEvery(0),
+    _renderFinal(false),
+    _frames(0),
+    _skipping(false),
+    _recorder(nullptr),
+    _nextKeyframe(),
+    _replay(nullptr),
+    _ghostScheduling(GhostScheduling::SERIAL),
+    _lockstep(false)
+{
+}
+
 void Game::init(const string& mapPath,
     const string& playerPath,
-    const vector<string>& ghostPaths)
+    const vector<string>& ghostPaths,
+    GhcEngine ghostEngine)
 {
     {
         ifstream stream(mapPath);
@@ -79,8 +83,16 @@ void Game::init(const string& mapPath,
 
     _ghosts.clear();
     _events.clear();
+    _frightExpiry = EventHandle {};
+    _clock = Clock {0};
+    _lastClock = Clock {0};
     _lives = 3;
     _score = 0;
+    _end = GameEnd::RUNNING;
+    _frames = 0;
+
+    // one program per path, shared by every ghost that runs it
+    auto ghostPrograms = vector<shared_ptr<const GhcProgram>>(ghostPaths.size());
 
     for(auto y = 0; y < _map.height(); y++)
     {
@@ -100,10 +112,14 @@ void Game::init(const string& mapPath,
             else if(ch == '=')
             {
                 auto ghostNum = _ghosts.size();
+                auto& program = ghostPrograms[ghostNum % ghostPaths.size()];
+
+                if(!program)
+                {
+                    program = GhcProgram::load(ghostPaths[ghostNum % ghostPaths.size()]);
+                }
 
-                ifstream stream(ghostPaths[ghostNum % ghostPaths.size()]);
-                _ghosts.emplace_back();
-                _ghosts.back().init(ghostNum, pos, stream);
+                _ghosts.add(pos, program, ghostEngine);
 
                 queueGhostMove({0}, ghostNum);
                 _map.set(pos, ' ');
@@ -123,41 +139,135 @@ void Game::init(const string& mapPath,
     queueEvent({EventType::FRUIT_EXPIRES, {127 * 480}, 0});
 }
 
+void Game::enableProfiling()
+{
+    for(auto i = 0; i < ghostCount(); i++)
+    {
+        _ghosts.ghost(i).enableProfiling();
+    }
+}
+
+void Game::enableTracing(GhcTraceWriter& writer)
+{
+    for(auto i = 0; i < ghostCount(); i++)
+    {
+        _ghosts.ghost(i).enableTracing(writer.buffer(i));
+    }
+}
+
+void Game::enableMemo(int validateEvery)
+{
+    for(auto i = 0; i < ghostCount(); i++)
+    {
+        _ghosts.ghost(i).enableMemo(validateEvery);
+    }
+}
+
+void Game::setGhostScheduling(GhostScheduling scheduling, int threads, bool lockstep)
+{
+    _ghostScheduling = scheduling;
+    _lockstep = lockstep;
+    _workers.reset();
+
+    if(scheduling != GhostScheduling::SERIAL)
+    {
+        _workers = make_shared<WorkerPool>(threads);
+    }
+}
+
+void Game::setHeadless(int renderEvery, bool renderFinal)
+{
+    _headless = true;
+    _renderEvery = renderEvery;
+    _renderFinal = renderFinal;
+}
+
+void Game::setAnsi(int viewWidth, int viewHeight)
+{
+    _renderer.setAnsi(viewWidth, viewHeight);
+}
+
+void Game::setPlayback(double speed)
+{
+    _playback.reset(new Playback(speed));
+}
+
+const Playback* Game::playback() const
+{
+    return _playback.get();
+}
+
+void Game::setRenderThread(FrameDropping dropping)
+{
+    _renderThread.reset(new RenderThread(_renderer, cout, dropping));
+}
+
+const RenderThread* Game::renderThread() const
+{
+    return _renderThread.get();
+}
+
 void Game::run()
 {
-    auto lastClock = Clock {};
+    runUntil(Clock {numeric_limits<int>::max()});
+}
+
+bool Game::runUntil(Clock until)
+{
+    if(_end != GameEnd::RUNNING)
+    {
+        return false;
+    }
 
-    while(_lives != 0)
+    while(_end == GameEnd::RUNNING)
     {
-        auto event = _events.front();
-        pop_heap(_events.begin(), _events.end(), EventComparer{});
-        _events.pop_back();
+        auto nextClock = _events.front().clock;
 
-        if(event.clock != lastClock)
+        if(_recorder && nextClock.value >= _nextKeyframe.value)
         {
-            consume(lastClock);
+            auto every = _recorder->keyframeEvery();
+            _recorder->keyframe(nextClock, checkpoint());
+            _nextKeyframe = Clock {(nextClock.value / every + 1) * every};
+        }
+
+        if(nextClock.value >= until.value)
+        {
+            return true;
+        }
+
+        auto event = _events.pop();
+
+        if(event.clock != _lastClock)
+        {
+            consume(_lastClock);
             collide();
-            dump(cout);
-            getchar();
+            render();
 
             if(_lives == 0)
             {
                 // game over
-                return;
+                _end = GameEnd::LOST;
+                break;
             }
                 
             if(remainingPills() == 0)
             {
                 // game over, won
                 _score *= _lives + 1;
-                return;
+                _end = GameEnd::WON;
+                break;
             }
+
+            _lastClock = event.clock;
         }
 
+        _clock = event.clock;
+
         switch(event.type)
         {
             case EventType::END_OF_LIVES:
                 _lives = 0;
+                _end = GameEnd::TIMEOUT;
                 break;
             case EventType::FRUIT_APPEARS:
                 _map.set(_fruitPos, '%');
@@ -166,21 +276,241 @@ void Game::run()
                 _map.set(_fruitPos, ' ');
                 break;
             case EventType::FRIGHT_MODE_EXPIRES:
-                for(auto& ghost : _ghosts)
-                {
-                    ghost.setInvisible(false);
-                }
+                _frightExpiry = EventHandle {};
+                _ghosts.setAllInvisible(false);
                 break;
             case EventType::PLAYER_MOVES:
+                if(_replay)
+                {
+                    _player.place(_player.position(), _replay->next(event.clock, REPLAY_PLAYER));
+                }
+
                 _player.step(_map);
+                recordMove(event.clock, REPLAY_PLAYER, _player.direction());
                 queuePlayerMove(event.clock);
                 break;
             case EventType::GHOST_MOVES:
-                _ghosts[event.arg].step(*this);
-                queueGhostMove(event.clock, event.arg);
+                if(_replay)
+                {
+                    _ghosts.moveAs(event.arg, _replay->next(event.clock, event.arg + 1), *this);
+                    recordMove(event.clock, event.arg + 1, _ghosts.direction(event.arg));
+                    queueGhostMove(event.clock, event.arg);
+                }
+                else if(_ghostScheduling == GhostScheduling::SERIAL)
+                {
+                    _ghosts.step(event.arg, *this);
+                    recordMove(event.clock, event.arg + 1, _ghosts.direction(event.arg));
+                    queueGhostMove(event.clock, event.arg);
+                }
+                else
+                {
+                    moveGhosts(event);
+                }
                 break;
         }
     }
+
+    if(_headless && _renderFinal)
+    {
+        draw(true);
+    }
+
+    // everything drawn before the game returns
+    if(_renderThread)
+    {
+        _renderThread->close();
+    }
+
+    return false;
+}
+
+bool Game::skipTo(Clock until)
+{
+    _skipping = true;
+    auto running = runUntil(until);
+    _skipping = false;
+
+    return running;
+}
+
+GameResult Game::result() const
+{
+    return GameResult {_score, _lives, _clock.value, remainingPills(), _end};
+}
+
+unique_ptr<Game> Game::fork() const
+{
+    unique_ptr<Game> copy(new Game());
+    forkInto(*copy);
+
+    return copy;
+}
+
+void Game::forkInto(Game& copy) const
+{
+    if(&copy == this)
+    {
+        throw logic_error("a game cannot fork into itself");
+    }
+
+    copy._originalMap = _originalMap;
+    copy._map = _map;
+    copy._player = _player;
+    copy._ghosts.assignShadows(_ghosts);
+    copy._events = _events;
+    copy._frightExpiry = _frightExpiry;
+    copy._clock = _clock;
+    copy._lastClock = _lastClock;
+    copy._fruitPos = _fruitPos;
+    copy._lives = _lives;
+    copy._score = _score;
+    copy._ghostValue = _ghostValue;
+    copy._end = _end;
+
+    // whatever copy was set up to do before, it now does what a fresh fork does
+    copy._frames = 0;
+    copy._renderer = Renderer();
+    copy._renderThread.reset();
+    copy._playback.reset();
+    copy._skipping = false;
+    copy._recorder = nullptr;
+    copy._nextKeyframe = Clock {};
+    copy._replay = nullptr;
+    copy._ghostScheduling = GhostScheduling::SERIAL;
+    copy._workers.reset();
+    copy._lockstep = false;
+    copy.setHeadless(0, false);
+}
+
+GameCheckpoint Game::checkpoint() const
+{
+    if(_end != GameEnd::RUNNING)
+    {
+        throw runtime_error("only a running game can be checkpointed");
+    }
+
+    auto checkpoint = GameCheckpoint();
+    checkpoint.originalMap = _originalMap;
+
+    for(auto y = 0; y < _map.height(); y++)
+    {
+        for(auto x = 0; x < _map.width(); x++)
+        {
+            auto pos = Position {x, y};
+
+            if(_map.get(pos) != _originalMap.get(pos))
+            {
+                checkpoint.changedSquares.push_back(GameCheckpointSquare {pos, _map.get(pos)});
+            }
+        }
+    }
+
+    checkpoint.clock = _clock;
+    checkpoint.lastClock = _lastClock;
+    checkpoint.fruitPos = _fruitPos;
+    checkpoint.lives = _lives;
+    checkpoint.score = _score;
+    checkpoint.ghostValue = _ghostValue;
+    checkpoint.frames = _frames;
+
+    checkpoint.playerStartPos = _player.startPosition();
+    checkpoint.playerPos = _player.position();
+    checkpoint.playerDirection = _player.direction();
+
+    for(auto i = 0; i < _ghosts.size(); i++)
+    {
+        auto& ghost = _ghosts.ghost(i);
+        auto state = GameCheckpointGhost();
+        auto& programs = checkpoint.programs;
+
+        state.program = 0;
+
+        while(state.program < (int)programs.size() && programs[state.program].get() != &ghost.program())
+        {
+            state.program++;
+        }
+
+        if(state.program == (int)programs.size())
+        {
+            programs.push_back(ghost.sharedProgram());
+        }
+
+        state.startPos = _ghosts.startPosition(i);
+        state.pos = _ghosts.position(i);
+        state.direction = _ghosts.direction(i);
+        state.invisible = _ghosts.invisible(i);
+        copy_n(ghost.registers(), sizeof(state.registers), state.registers);
+        copy_n(ghost.data(), sizeof(state.data), state.data);
+
+        checkpoint.ghosts.push_back(state);
+    }
+
+    checkpoint.events = _events.pending();
+
+    return checkpoint;
+}
+
+void Game::resume(const GameCheckpoint& checkpoint, GhcEngine ghostEngine)
+{
+    _originalMap = checkpoint.originalMap;
+    _map = _originalMap;
+
+    for(auto& change : checkpoint.changedSquares)
+    {
+        _map.set(change.pos, change.square);
+    }
+
+    _ghosts.clear();
+    _events.clear();
+    _frightExpiry = EventHandle {};
+    _clock = checkpoint.clock;
+    _lastClock = checkpoint.lastClock;
+    _fruitPos = checkpoint.fruitPos;
+    _lives = checkpoint.lives;
+    _score = checkpoint.score;
+    _ghostValue = checkpoint.ghostValue;
+    _end = GameEnd::RUNNING;
+    _frames = checkpoint.frames;
+
+    // the player has no program to read yet
+    istringstream noProgram;
+    _player.init(checkpoint.playerStartPos, noProgram);
+    _player.place(checkpoint.playerPos, checkpoint.playerDirection);
+
+    for(auto& state : checkpoint.ghosts)
+    {
+        auto ghostNum = _ghosts.add(state.startPos, checkpoint.programs[state.program], ghostEngine);
+        _ghosts.place(ghostNum, state.pos, state.direction);
+        _ghosts.setInvisible(ghostNum, state.invisible);
+        _ghosts.ghost(ghostNum).restore(state.registers, state.data);
+    }
+
+    for(auto& event : checkpoint.events)
+    {
+        if(event.type == EventType::GHOST_MOVES && event.arg >= _ghosts.size())
+        {
+            throw runtime_error("checkpoint moves a ghost it does not have");
+        }
+
+        auto handle = queueEvent(event);
+
+        // at most one is queued, and only in fright mode
+        if(event.type == EventType::FRIGHT_MODE_EXPIRES)
+        {
+            _frightExpiry = handle;
+        }
+    }
+}
+
+void Game::record(ReplayWriter& writer)
+{
+    _recorder = &writer;
+    _nextKeyframe = Clock {0};
+}
+
+void Game::replay(ReplayReader& reader)
+{
+    _replay = &reader;
 }
 
 const Map& Game::originalMap() const
@@ -200,7 +530,22 @@ const Player& Game::player() const
 
 const Ghost& Game::ghost(int ghostNum) const
 {
-    return _ghosts[ghostNum];
+    return _ghosts.ghost(ghostNum);
+}
+
+const GhostPool& Game::ghosts() const
+{
+    return _ghosts;
+}
+
+Clock Game::clock() const
+{
+    return _clock;
+}
+
+int Game::ghostCount() const
+{
+    return _ghosts.size();
 }
 
 void Game::consume(Clock thisClock)
@@ -218,7 +563,7 @@ void Game::consume(Clock thisClock)
         _score += POWER_PILL_VALUE;
         _ghostValue = FIRST_GHOST_VALUE;
         clearFrightMode();
-        queueEvent({EventType::FRIGHT_MODE_EXPIRES, thisClock, 0});
+        _frightExpiry = queueEvent({EventType::FRIGHT_MODE_EXPIRES, thisClock, 0});
     }
     else if(ch == '%')
     {
@@ -229,22 +574,22 @@ void Game::consume(Clock thisClock)
 
 void Game::collide()
 {
-    for(auto& ghost : _ghosts)
+    for(auto i = 0; i < _ghosts.size(); i++)
     {
-        if(ghost.invisible())
+        if(_ghosts.invisible(i))
         {
             continue;
         }
 
-        if(ghost.position() != _player.position())
+        if(_ghosts.position(i) != _player.position())
         {
             continue;
         }
 
         if(frightMode())
         {
-            ghost.setInvisible(true);
-            ghost.reset();
+            _ghosts.setInvisible(i, true);
+            _ghosts.reset(i);
             _score += _ghostValue;
             _ghostValue = min(_ghostValue * 2, MAX_GHOST_VALUE);
         }
@@ -254,10 +599,11 @@ void Game::collide()
 
             _player.reset();
 
-            for(auto& ghost2 : _ghosts)
+            _ghosts.setAllInvisible(false);
+
+            for(auto j = 0; j < _ghosts.size(); j++)
             {
-                ghost2.setInvisible(false);
-                ghost2.reset();
+                _ghosts.reset(j);
             }
 
             _lives--;
@@ -292,103 +638,238 @@ void Game::queueGhostMove(Clock thisClock, int ghostNum)
     queueEvent({EventType::GHOST_MOVES, nextClock, ghostNum});
 }
 
-void Game::queueEvent(Event event)
-{
-    _events.push_back(event);
-    push_heap(_events.begin(), _events.end(), EventComparer{});
-}
-
-void Game::clearFrightMode()
+// Runs every ghost moving on event's tick at once. A ghost's program only
+// reads the game and its own state, so the order they run in doesn't
+// matter as long as they move in ghostNum order afterwards.
+void Game::moveGhosts(Event event)
 {
-    auto mustHeapify = false;
+    _movingGhosts.assign(1, event.arg);
 
-    for(auto it = _events.begin(); it != _events.end(); /**/)
+    // the rest of this tick's moves are next in the queue, by ghostNum
+    while(!_events.empty())
     {
-        if(it->type == EventType::FRIGHT_MODE_EXPIRES)
+        auto next = _events.front();
+
+        if(next.type != EventType::GHOST_MOVES || next.clock.value != event.clock.value)
         {
-            it = _events.erase(it);
-            mustHeapify = true;
+            break;
         }
-        else
+
+        _events.pop();
+        _movingGhosts.push_back(next.arg);
+    }
+
+    auto count = (int)_movingGhosts.size();
+    auto serial = vector<Ghost> {};
+    auto serialErrors = vector<exception_ptr> {};
+
+    // keep the serial run's errors too, so a program the parallel engines
+    // accept but Ghost::run rejects (or the reverse) counts as divergence
+    if(_ghostScheduling == GhostScheduling::CHECKED)
+    {
+        for(auto ghostNum : _movingGhosts)
         {
-            ++it;
+            serial.push_back(_ghosts.ghost(ghostNum).shadow());
+            serialErrors.push_back(nullptr);
+
+            try
+            {
+                serial.back().run(*this, _ghosts.direction(ghostNum));
+            }
+            catch(...)
+            {
+                serialErrors.back() = current_exception();
+            }
         }
     }
 
-    if(mustHeapify)
+    _ghostErrors.assign(count, nullptr);
+
+    if(_lockstep)
     {
-        make_heap(_events.begin(), _events.end(), EventComparer {});
+        batchGhosts();
+
+        _workers->forEach((int)_ghostBatches.size(), [this](int b)
+        {
+            auto& batch = _ghostBatches[b];
+            int ghostNums[GHC_LANES];
+            exception_ptr errors[GHC_LANES];
+
+            for(auto lane = 0; lane < batch.size; lane++)
+            {
+                ghostNums[lane] = _movingGhosts[batch.lanes[lane]];
+            }
+
+            if(!batch.program)
+            {
+                try
+                {
+                    _ghosts.run(ghostNums[0], *this);
+                }
+                catch(...)
+                {
+                    errors[0] = current_exception();
+                }
+            }
+            else
+            {
+                _ghosts.runLockstep(ghostNums, batch.size, *this, errors);
+            }
+
+            for(auto lane = 0; lane < batch.size; lane++)
+            {
+                if(errors[lane])
+                {
+                    _ghostErrors[batch.lanes[lane]] = errors[lane];
+                }
+            }
+        });
+    }
+    else
+    {
+        _workers->forEach(count, [this](int i)
+        {
+            try
+            {
+                _ghosts.run(_movingGhosts[i], *this);
+            }
+            catch(...)
+            {
+                _ghostErrors[i] = current_exception();
+            }
+        });
     }
-}
 
-bool Game::eating() const
-{
-    return _map.get(_player.position()) != ' ';
+    for(auto i = 0; i < count; i++)
+    {
+        if(_ghostScheduling == GhostScheduling::CHECKED && !_ghostErrors[i] != !serialErrors[i])
+        {
+            throw logic_error("parallel ghost moves diverged from serial ones");
+        }
+
+        if(_ghostErrors[i])
+        {
+            rethrow_exception(_ghostErrors[i]);
+        }
+
+        auto ghostNum = _movingGhosts[i];
+
+        if(_ghostScheduling == GhostScheduling::CHECKED && !_ghosts.ghost(ghostNum).sameState(serial[i]))
+        {
+            throw logic_error("parallel ghost moves diverged from serial ones");
+        }
+
+        _ghosts.move(ghostNum, *this);
+        recordMove(event.clock, ghostNum + 1, _ghosts.direction(ghostNum));
+        queueGhostMove(event.clock, ghostNum);
+    }
 }
 
-bool Game::frightMode() const
+// Groups this tick's moving ghosts into lockstep batches by program, in
+// ghostNum order so batches come out the same every run
+void Game::batchGhosts()
 {
-    for(auto& event : _events)
+    _ghostBatches.clear();
+
+    for(auto i = 0; i < (int)_movingGhosts.size(); i++)
     {
-        if(event.type == EventType::FRIGHT_MODE_EXPIRES)
+        auto& ghost = _ghosts.ghost(_movingGhosts[i]);
+        auto program = GhcLockstep::eligible(ghost) ? &ghost.program() : nullptr;
+        auto found = false;
+
+        for(auto& batch : _ghostBatches)
         {
-            return true;
+            if(program && batch.program == program && batch.size < GHC_LANES)
+            {
+                batch.lanes[batch.size++] = i;
+                found = true;
+                break;
+            }
         }
-    }
 
-    return false;
+        if(!found)
+        {
+            _ghostBatches.push_back(GhostBatch {program, 1, {i}});
+        }
+    }
 }
 
-int Game::level() const
+void Game::recordMove(Clock thisClock, int actor, Direction direction)
 {
-    return _map.width() * _map.height() / 100 + 1;
+    if(_recorder)
+    {
+        _recorder->move(thisClock, actor, direction);
+    }
 }
 
-int Game::remainingPills() const
+// Shows the frame just finished. Interactive games wait for a key, and
+// played back ones for the frame to be due.
+void Game::render()
 {
-    auto numPills = 0;
+    auto frame = _frames++;
 
-    for(auto y = 0; y < _map.height(); y++)
+    if(_skipping)
     {
-        for(auto x = 0; x < _map.width(); x++)
-        {
-            auto ch = _map.get({x, y});
+        return;
+    }
 
-            if(ch == '.')
-            {
-                numPills++;
-            }
+    if(_playback)
+    {
+        if(_playback->pace(_clock.value))
+        {
+            draw(true);
         }
     }
+    else if(!_headless)
+    {
+        draw(true);
+        getchar();
+    }
+    else if(_renderEvery > 0 && frame % _renderEvery == 0)
+    {
+        draw(false);
+    }
+}
 
-    return numPills;
+EventHandle Game::queueEvent(Event event)
+{
+    return _events.push(event);
 }
 
-void Game::dump(ostream& os) const
+void Game::clearFrightMode()
 {
-    for(auto y = 0; y < _map.height(); y++)
-    {
-        for(auto x = 0; x < _map.width(); x++)
-        {
-            auto pos = Position {x, y};
-            char ch = _map.get(pos);
+    _events.cancel(_frightExpiry);
+    _frightExpiry = EventHandle {};
+}
 
-            if(_player.position() == pos)
-            {
-                ch = '\\';
-            }
+bool Game::eating() const
+{
+    return _map.get(_player.position()) != ' ';
+}
 
-            for(auto& ghost : _ghosts)
-            {
-                if(ghost.position() == pos)
-                {
-                    ch = '=';
-                }
-            }
+bool Game::frightMode() const
+{
+    return _frightExpiry.id != 0;
+}
 
-            os << ch;
-        }
+int Game::level() const
+{
+    return _map.width() * _map.height() / 100 + 1;
+}
 
-        os << '\n';
+int Game::remainingPills() const
+{
+    return _map.count('.');
+}
+
+void Game::draw(bool keep)
+{
+    if(_renderThread)
+    {
+        _renderThread->push(_map, _player.position(), _ghosts, keep);
+        return;
     }
+
+    _frame.capture(_map, _player.position(), _ghosts);
+    _renderer.draw(cout, _frame);
 }
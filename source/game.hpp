@@ -1,72 +1,200 @@
 #ifndef LAMCO_GAME_HPP
 #define LAMCO_GAME_HPP
 
-#include "Map.hpp"
-#include "Player.hpp"
-#include "Ghost.hpp"
+#include "checkpoint.hpp"
+#include "events.hpp"
+#include "map.hpp"
+#include "playback.hpp"
+#include "player.hpp"
+#include "render.hpp"
+#include "replay.hpp"
+#include "ghost.hpp"
+#include "ghostpool.hpp"
+#include "lockstep.hpp"
+#include "trace.hpp"
+#include "workerpool.hpp"
+#include <exception>
+#include <memory>
 
 using namespace std;
 
-struct Clock
+// How ghosts moving on the same tick are run
+enum class GhostScheduling
 {
-    int value;
+    SERIAL,
+    // their programs run in parallel on a worker pool, then they move in
+    // ghostNum order
+    PARALLEL,
+    // PARALLEL, checked against serial runs of the same ghosts every tick
+    CHECKED
 };
 
-enum class EventType
+// Why a game stopped
+enum class GameEnd
 {
-    // Events here occur in the order listed here when on the same tick
-    END_OF_LIVES,
-    PLAYER_MOVES,
-    GHOST_MOVES,
-    FRUIT_APPEARS,
-    FRUIT_EXPIRES,
-    FRIGHT_MODE_EXPIRES
+    RUNNING,
+    // out of lives
+    LOST,
+    // every pill eaten
+    WON,
+    // the end of lives clock ran out
+    TIMEOUT
 };
 
-struct Event
+const char* gameEndName(GameEnd end);
+
+struct GameResult
 {
-    EventType type;
-    Clock clock;
-    int arg;
+    int score;
+    int lives;
+    // clock of the last event processed
+    int ticks;
+    int pillsLeft;
+    GameEnd end;
 };
 
 class Game
 {
 public:
+    Game();
+
     void init(const string& mapPath,
         const string& playerPath,
-        const vector<string>& ghostPaths);
+        const vector<string>& ghostPaths,
+        GhcEngine ghostEngine = GhcEngine::INTERPRETER);
+    void enableProfiling();
+    // Ghost i traces int 8 into writer.buffer(i)
+    void enableTracing(GhcTraceWriter& writer);
+    // See Ghost::enableMemo
+    void enableMemo(int validateEvery);
+    // With lockstep, ghosts that share an interpreted program run in
+    // batches through GhcLockstep; ignored when SERIAL
+    void setGhostScheduling(GhostScheduling scheduling, int threads, bool lockstep = false);
+    // Headless games don't wait for input between frames and only render
+    // every renderEvery-th frame, if renderEvery is above 0, and the final
+    // frame if renderFinal
+    void setHeadless(int renderEvery, bool renderFinal);
+    // Frames redraw what changed, in a viewWidth by viewHeight terminal
+    void setAnsi(int viewWidth, int viewHeight);
+    // Frames are paced to the wall clock instead of waiting for a key
+    void setPlayback(double speed);
+    // null unless playback is on
+    const Playback* playback() const;
+    // Headless games draw frames on a RenderThread from now on
+    void setRenderThread(FrameDropping dropping);
+    // null unless there is a render thread
+    const RenderThread* renderThread() const;
     void run();
+    // Plays until the next event is due at or after until, leaving it
+    // queued, or the game ends. What the player eats and runs into on the
+    // last tick played is settled when play resumes. Returns whether the
+    // game is still going.
+    bool runUntil(Clock until);
+    GameResult result() const;
+    // An independent copy of the game as it stands, to play ahead from. It
+    // shares the map's squares until either game changes them, and every
+    // ghost program. Forks are headless, draw nothing, run their ghosts
+    // serially and report nothing from them: no profiles, traces, memos
+    // or register dumps.
+    unique_ptr<Game> fork() const;
+    // fork() into copy, which is left as if it had just been returned by
+    // fork(). Reusing one scratch game saves building a whole Game, every
+    // ghost VM included, per fork.
+    void forkInto(Game& copy) const;
+    // The game as runUntil left it, to carry on from later
+    GameCheckpoint checkpoint() const;
+    // In place of init, carries on from checkpoint exactly as the game it
+    // was taken from would have, running every ghost under ghostEngine
+    void resume(const GameCheckpoint& checkpoint,
+        GhcEngine ghostEngine = GhcEngine::INTERPRETER);
+    // Records every move from now on, and keyframes as often as writer asks
+    void record(ReplayWriter& writer);
+    // Moves as reader recorded from now on, without running ghost programs,
+    // so the VMs fall out of date; resume from one of its keyframes first
+    void replay(ReplayReader& reader);
+    // runUntil, drawing nothing; frames still count towards renderEvery
+    bool skipTo(Clock until);
 
     const Map& originalMap() const;
     const Map& map() const;
     const Player& player() const;
     const Ghost& ghost(int ghostNum) const;
+    const GhostPool& ghosts() const;
+    int ghostCount() const;
     bool frightMode() const;
+    // clock of the event being processed
+    Clock clock() const;
 
 private:
+    Game(const Game&);
+    Game& operator=(const Game&);
+
     void consume(Clock thisClock);
     void collide();
     void queuePlayerMove(Clock thisClock);
     void queueGhostMove(Clock thisClock, int ghostNum);
-    void queueEvent(Event event);
+    void moveGhosts(Event event);
+    void batchGhosts();
+    void recordMove(Clock thisClock, int actor, Direction direction);
+    EventHandle queueEvent(Event event);
     void clearFrightMode();
+    void render();
+    // keep: draw the frame even if a render thread would drop it
+    void draw(bool keep);
 
     bool eating() const;
     int level() const;
     int remainingPills() const;
 
-    void dump(ostream& os) const;
-
     Map _originalMap;
     Map _map;
     Player _player;
-    vector<Ghost> _ghosts;
-    vector<Event> _events;
+    GhostPool _ghosts;
+    EventQueue _events;
+    // the pending FRIGHT_MODE_EXPIRES, if in fright mode
+    EventHandle _frightExpiry;
+    Clock _clock;
+    // the tick being played, whose end is yet to be settled
+    Clock _lastClock;
     Position _fruitPos;
     int _lives;
     int _score;
     int _ghostValue;
+    GameEnd _end;
+
+    bool _headless;
+    int _renderEvery;
+    bool _renderFinal;
+    // frames rendered or skipped so far
+    int _frames;
+    Renderer _renderer;
+    Frame _frame;
+    unique_ptr<RenderThread> _renderThread;
+    unique_ptr<Playback> _playback;
+    bool _skipping;
+
+    ReplayWriter* _recorder;
+    // keyframes are taken before the first event due at or after this
+    Clock _nextKeyframe;
+    ReplayReader* _replay;
+
+    GhostScheduling _ghostScheduling;
+    shared_ptr<WorkerPool> _workers;
+    // ghosts moving on the current tick and what went wrong running them
+    vector<int> _movingGhosts;
+    vector<exception_ptr> _ghostErrors;
+
+    // Indexes into _movingGhosts run together; a batch without a program
+    // holds one ghost that runs on its own
+    struct GhostBatch
+    {
+        const GhcProgram* program;
+        int size;
+        int lanes[GHC_LANES];
+    };
+
+    bool _lockstep;
+    vector<GhostBatch> _ghostBatches;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "ghost.hpp"
+#include "assembler.hpp"
+#include "native.hpp"
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+// Translates a ghost program into a C++ module implementing the
+// GhcNativeEntry contract. Link the output into lamco and Game::init runs
+// it for any ghost whose source hashes the same and assembles to the same
+// instructions, which the module carries.
+
+static string operand(GhcArgument arg, int pc)
+{
+    auto value = to_string(arg.value);
+
+    if(arg.isRegister)
+    {
+        // reading PC yields the address of the executing instruction
+        value = arg.value == 0 ? to_string(pc) : "r[" + value + "]";
+    }
+
+    return arg.isIndirect ? "d[" + value + "]" : value;
+}
+
+static bool isBadStore(const GhcInstruction& instr)
+{
+    return (instr.arg1.isRegister && instr.arg1.value == 0) ||
+        instr.arg1.mode() == GhcMode::CONSTANT;
+}
+
+class Translator
+{
+public:
+    Translator(const vector<GhcInstruction>& code, ostream& os) :
+        _code(code),
+        _os(os)
+    {
+    }
+
+    void translateBody()
+    {
+        for(auto pc = 0; pc < (int)_code.size(); pc++)
+        {
+            translate(pc);
+        }
+
+        // falling off the end wraps to PC 0 or leaves the program
+        _os << "    r[0] = " << (_code.size() & 0xFF) << ";\n";
+        _os << "    goto dispatch;\n\n";
+    }
+
+private:
+    void translate(int pc)
+    {
+        auto& instr = _code[pc];
+        auto dest = operand(instr.arg1, pc);
+        auto src = operand(instr.arg2, pc);
+
+        _os << "pc_" << pc << ": // " << formatInstruction(instr) << "\n";
+
+        if(instr.opcode == GhcOpcode::HLT)
+        {
+            _os << "    r[0] = " << pc << ";\n";
+            _os << "    status = GhcNativeStatus::HALTED;\n";
+            _os << "    goto done;\n\n";
+            return;
+        }
+
+        _os << "    if(fuel == 0) { r[0] = " << pc << "; goto done; }\n";
+
+        switch(instr.opcode)
+        {
+            case GhcOpcode::MOV:
+                store(pc, dest, src);
+                break;
+            case GhcOpcode::INC:
+                store(pc, dest, "(uint8_t)(" + dest + " + 1)");
+                break;
+            case GhcOpcode::DEC:
+                store(pc, dest, "(uint8_t)(" + dest + " - 1)");
+                break;
+            case GhcOpcode::ADD:
+                store(pc, dest, "(uint8_t)(" + dest + " + " + src + ")");
+                break;
+            case GhcOpcode::SUB:
+                store(pc, dest, "(uint8_t)(" + dest + " - " + src + ")");
+                break;
+            case GhcOpcode::MUL:
+                store(pc, dest, "(uint8_t)(" + dest + " * " + src + ")");
+                break;
+            case GhcOpcode::DIV:
+                // the interpreter reports division by zero
+                _os << "    if(" << src << " == 0) { r[0] = " << pc << "; goto done; }\n";
+                store(pc, dest, "(uint8_t)(" + dest + " / " + src + ")");
+                break;
+            case GhcOpcode::AND:
+                store(pc, dest, "(uint8_t)(" + dest + " & " + src + ")");
+                break;
+            case GhcOpcode::OR:
+                store(pc, dest, "(uint8_t)(" + dest + " | " + src + ")");
+                break;
+            case GhcOpcode::XOR:
+                store(pc, dest, "(uint8_t)(" + dest + " ^ " + src + ")");
+                break;
+            case GhcOpcode::JLT:
+                jump(pc, "<");
+                break;
+            case GhcOpcode::JEQ:
+                jump(pc, "==");
+                break;
+            case GhcOpcode::JGT:
+                jump(pc, ">");
+                break;
+            case GhcOpcode::INT:
+                _os << "    fuel--;\n";
+                _os << "    r[0] = " << pc << ";\n";
+                _os << "    if(context->interrupt(context, " << dest << ") != 0) { status = GhcNativeStatus::FAILED; goto done; }\n";
+                break;
+            case GhcOpcode::HLT:
+                break;
+        }
+
+        _os << "\n";
+    }
+
+    void store(int pc, const string& dest, const string& value)
+    {
+        if(isBadStore(_code[pc]))
+        {
+            // the interpreter reports the fault
+            _os << "    r[0] = " << pc << ";\n";
+            _os << "    goto done;\n";
+            return;
+        }
+
+        _os << "    fuel--;\n";
+        _os << "    " << dest << " = " << value << ";\n";
+    }
+
+    void jump(int pc, const string& op)
+    {
+        auto& instr = _code[pc];
+
+        _os << "    fuel--;\n";
+        _os << "    {\n";
+        _os << "        uint8_t lhs = " << operand(instr.arg2, pc) << ";\n";
+        _os << "        uint8_t rhs = " << operand(instr.arg3, pc) << ";\n";
+        _os << "        if(lhs " << op << " rhs) ";
+
+        if(instr.arg1.mode() == GhcMode::CONSTANT && instr.arg1.value < _code.size())
+        {
+            _os << "goto pc_" << (int)instr.arg1.value << ";\n";
+        }
+        else
+        {
+            _os << "{ r[0] = " << operand(instr.arg1, pc) << "; goto dispatch; }\n";
+        }
+
+        _os << "    }\n";
+    }
+
+    const vector<GhcInstruction>& _code;
+    ostream& _os;
+};
+
+// The file name without directory or extension. It ends up in the
+// generated C++, so anything but identifier characters becomes '_'.
+static string moduleName(const string& path)
+{
+    auto start = path.find_last_of('/');
+    start = (start == string::npos) ? 0 : start + 1;
+
+    auto end = path.find('.', start);
+    auto name = path.substr(start, end == string::npos ? string::npos : end - start);
+
+    for(auto& c : name)
+    {
+        if(!isalnum((unsigned char)c) && c != '_')
+        {
+            c = '_';
+        }
+    }
+
+    return name;
+}
+
+int main(int argc, char* argv[])
+{
+    try
+    {
+        if(argc != 3)
+        {
+            throw runtime_error("usage: ghc2cpp <input.ghc> <output.cpp>");
+        }
+
+        auto inputPath = string {argv[1]};
+        auto source = string {};
+
+        {
+            ifstream stream(inputPath);
+
+            if(!stream)
+            {
+                throw runtime_error("bad input stream");
+            }
+
+            source.assign(istreambuf_iterator<char>(stream), istreambuf_iterator<char>());
+        }
+
+        istringstream sourceStream(source);
+        auto code = parseProgram(sourceStream);
+
+        if(code.empty() || code.size() > 256)
+        {
+            throw runtime_error("program must have between 1 and 256 instructions");
+        }
+
+        stringstream body;
+        Translator translator(code, body);
+        translator.translateBody();
+
+        ofstream os(argv[2]);
+
+        if(!os)
+        {
+            throw runtime_error("bad output stream");
+        }
+
+        os << "// Generated by ghc2cpp from " << moduleName(inputPath) << "; do not edit\n";
+        os << "#include \"native.hpp\"\n\n";
+        os << "namespace\n{\n\n";
+        os << "int run(GhcNativeContext* context)\n{\n";
+        os << "    auto r = context->registers;\n";
+        os << "    auto d = context->data;\n";
+        os << "    auto fuel = context->fuel;\n";
+        os << "    auto status = GhcNativeStatus::CONTINUE;\n\n";
+        os << "    (void)d;\n\n";
+        os << "dispatch:\n";
+        os << "    switch(r[0])\n    {\n";
+
+        for(auto pc = 0u; pc < code.size(); pc++)
+        {
+            os << "        case " << pc << ": goto pc_" << pc << ";\n";
+        }
+
+        os << "        default: goto done;\n";
+        os << "    }\n\n";
+        os << body.str();
+        os << "done:\n";
+        os << "    context->fuel = fuel;\n";
+        os << "    return (int)status;\n";
+        os << "}\n\n";
+        // the instructions, byte for byte as .ghcb stores them
+        os << "const uint8_t code[] =\n{\n";
+
+        for(auto& instr : code)
+        {
+            auto bytes = (const uint8_t*)&instr;
+            os << "   ";
+
+            for(auto i = 0u; i < sizeof(GhcInstruction); i++)
+            {
+                os << " " << (int)bytes[i] << ",";
+            }
+
+            os << " // " << formatInstruction(instr) << "\n";
+        }
+
+        os << "};\n\n";
+        os << "GhcModuleRegistration registration(0x" << hex << hashProgram(source) << dec << "ull, \""
+           << moduleName(inputPath) << "\", &run, code, " << code.size() << ");\n\n";
+        os << "}\n";
+    }
+    catch(const runtime_error& e)
+    {
+        cerr << "An error occurred: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
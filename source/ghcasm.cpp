@@ -0,0 +1,38 @@
+#include "assembler.hpp"
+#include "mappedfile.hpp"
+#include "native.hpp"
+#include <fstream>
+
+// Assembles a ghost program into the .ghcb binary format, which loads with
+// a header check instead of a parse
+int main(int argc, char* argv[])
+{
+    try
+    {
+        if(argc != 3)
+        {
+            throw runtime_error("usage: ghcasm <input.ghc> <output.ghcb>");
+        }
+
+        MappedFile input(argv[1]);
+        GhcInstruction code[GHC_MAX_PROGRAM_SIZE];
+        auto size = assembleProgram(input.data(), input.size(), code);
+
+        ofstream os(argv[2], ios::binary);
+
+        if(!os)
+        {
+            throw runtime_error("bad output stream");
+        }
+
+        // keep the source hash so modules from ghc2cpp still match
+        writeBinaryProgram(os, vector<GhcInstruction>(code, code + size), hashProgram(input.data(), input.size()));
+    }
+    catch(const runtime_error& e)
+    {
+        cerr << "An error occurred: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+#include "trace.hpp"
+#include <iomanip>
+#include <iostream>
+
+// Prints a binary trace written by lamco --trace, one int 8 call per line
+int main(int argc, char* argv[])
+{
+    try
+    {
+        if(argc != 2)
+        {
+            throw runtime_error("usage: ghctrace <trace>");
+        }
+
+        ifstream is(argv[1], ios::binary);
+
+        if(!is)
+        {
+            throw runtime_error("bad input stream");
+        }
+
+        readTraceHeader(is);
+
+        cout << "   clock ghost  pc    a   b   c   d   e   f   g   h\n";
+
+        auto record = GhcTraceRecord {};
+
+        while(readTraceRecord(is, record))
+        {
+            cout << setw(8) << record.clock << setw(6) << record.ghostNum << setw(4) << (int)record.pc << " ";
+
+            for(auto r : record.registers)
+            {
+                cout << setw(4) << (int)r;
+            }
+
+            cout << "\n";
+        }
+    }
+    catch(const runtime_error& e)
+    {
+        cerr << "An error occurred: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -1,248 +1,1167 @@
 #include "ghost.hpp"
+#include "assembler.hpp"
 #include "game.hpp"
-#include <sstream>
+#include "jit.hpp"
+#include "mappedfile.hpp"
+#include "memo.hpp"
+#include "native.hpp"
+#include "profile.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <cstring>
+#include <map>
 
-static const int MAX_INSTR_COUNT = 1024;
+struct GhcAdd { static uint8_t apply(uint8_t a, uint8_t b) { return a + b; } };
+struct GhcSub { static uint8_t apply(uint8_t a, uint8_t b) { return a - b; } };
+struct GhcMul { static uint8_t apply(uint8_t a, uint8_t b) { return a * b; } };
+struct GhcDiv
+{
+    static uint8_t apply(uint8_t a, uint8_t b)
+    {
+        if(b == 0)
+        {
+            throw runtime_error("division by zero");
+        }
+
+        return a / b;
+    }
+};
+struct GhcAnd { static uint8_t apply(uint8_t a, uint8_t b) { return a & b; } };
+struct GhcOr { static uint8_t apply(uint8_t a, uint8_t b) { return a | b; } };
+struct GhcXor { static uint8_t apply(uint8_t a, uint8_t b) { return a ^ b; } };
+struct GhcLess { static bool apply(uint8_t a, uint8_t b) { return a < b; } };
+struct GhcEqual { static bool apply(uint8_t a, uint8_t b) { return a == b; } };
+struct GhcGreater { static bool apply(uint8_t a, uint8_t b) { return a > b; } };
+
+struct GhcNativeFrame
+{
+    Ghost* ghost;
+    const Game* game;
+    exception_ptr error;
+};
+
+// Instruction handlers, specialized on operand modes so the hot loop
+// never inspects a GhcArgument
+struct GhcOps
+{
+    // Handler result for continuing at pc
+    static int proceed(uint8_t pc)
+    {
+        return pc;
+    }
+
+    // Handler result for continuing at pc when the last unused instructions
+    // of a superinstruction were skipped
+    static int refund(uint8_t pc, int unused)
+    {
+        return pc | unused << 8;
+    }
+
+    template<GhcMode Mode>
+    static uint8_t load(const Ghost& ghost, uint8_t value)
+    {
+        switch(Mode)
+        {
+            case GhcMode::REGISTER:
+                return ghost._registers[value];
+            case GhcMode::CONSTANT:
+                return value;
+            case GhcMode::INDIRECT_REGISTER:
+                return ghost._data[ghost._registers[value]];
+            case GhcMode::INDIRECT_CONSTANT:
+                return ghost._data[value];
+        }
+
+        return 0;
+    }
+
+    static uint8_t load(const Ghost& ghost, GhcArgument arg)
+    {
+        switch(arg.mode())
+        {
+            case GhcMode::REGISTER:
+                return load<GhcMode::REGISTER>(ghost, arg.value);
+            case GhcMode::CONSTANT:
+                return load<GhcMode::CONSTANT>(ghost, arg.value);
+            case GhcMode::INDIRECT_REGISTER:
+                return load<GhcMode::INDIRECT_REGISTER>(ghost, arg.value);
+            case GhcMode::INDIRECT_CONSTANT:
+                return load<GhcMode::INDIRECT_CONSTANT>(ghost, arg.value);
+        }
+
+        return 0;
+    }
+
+    // Stores to PC and to constants are rejected by decode()
+    template<GhcMode Mode>
+    static void store(Ghost& ghost, uint8_t dest, uint8_t value)
+    {
+        switch(Mode)
+        {
+            case GhcMode::REGISTER:
+                ghost._registers[dest] = value;
+                break;
+            case GhcMode::CONSTANT:
+                break;
+            case GhcMode::INDIRECT_REGISTER:
+                ghost._data[ghost._registers[dest]] = value;
+                break;
+            case GhcMode::INDIRECT_CONSTANT:
+                ghost._data[dest] = value;
+                break;
+        }
+    }
+
+    template<GhcMode Dest, GhcMode Src>
+    struct Mov
+    {
+        static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+        {
+            store<Dest>(ghost, instr.arg1, load<Src>(ghost, instr.arg2));
+            return proceed(instr.nextPc);
+        }
+    };
+
+    template<int Delta>
+    struct Step
+    {
+        template<GhcMode Dest>
+        struct Handler
+        {
+            static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+            {
+                store<Dest>(ghost, instr.arg1, load<Dest>(ghost, instr.arg1) + Delta);
+                return proceed(instr.nextPc);
+            }
+        };
+    };
+
+    template<class Op>
+    struct Binary
+    {
+        template<GhcMode Dest, GhcMode Src>
+        struct Handler
+        {
+            static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+            {
+                store<Dest>(ghost, instr.arg1, Op::apply(load<Dest>(ghost, instr.arg1), load<Src>(ghost, instr.arg2)));
+                return proceed(instr.nextPc);
+            }
+        };
+    };
+
+    template<class Op>
+    struct Jump
+    {
+        template<GhcMode Target, GhcMode Lhs, GhcMode Rhs>
+        struct Handler
+        {
+            static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+            {
+                if(Op::apply(load<Lhs>(ghost, instr.arg2), load<Rhs>(ghost, instr.arg3)))
+                {
+                    return proceed(load<Target>(ghost, instr.arg1));
+                }
+
+                return proceed(instr.nextPc);
+            }
+        };
+    };
+
+    template<GhcMode Num>
+    struct Int
+    {
+        static int run(Ghost& ghost, const Game& game, const GhcDecodedInstruction& instr)
+        {
+            ghost.handleInterrupt(game, load<Num>(ghost, instr.arg1));
+            return proceed(instr.nextPc);
+        }
+    };
+
+    template<GhcMode Target>
+    struct Goto
+    {
+        static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+        {
+            return proceed(load<Target>(ghost, instr.arg1));
+        }
+    };
+
+    static int nop(Ghost&, const Game&, const GhcDecodedInstruction& instr)
+    {
+        return proceed(instr.nextPc);
+    }
+
+    // mov r,x; int n
+    template<GhcMode Src>
+    struct MovInt
+    {
+        static int run(Ghost& ghost, const Game& game, const GhcDecodedInstruction& instr)
+        {
+            ghost._registers[instr.arg1] = load<Src>(ghost, instr.arg2);
+            ghost._registers[0] = instr.nextPc;
+            ghost.handleInterrupt(game, instr.arg3);
+            return proceed(instr.nextPc + 1);
+        }
+    };
+
+    // inc/dec r; jxx target,lhs,rhs
+    template<int Delta, class Op>
+    struct StepJump
+    {
+        template<GhcMode Lhs, GhcMode Rhs>
+        struct Handler
+        {
+            static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+            {
+                ghost._registers[instr.arg1] += Delta;
+
+                if(Op::apply(load<Lhs>(ghost, instr.arg2), load<Rhs>(ghost, instr.arg3)))
+                {
+                    return proceed(instr.arg4);
+                }
+
+                return proceed(instr.nextPc + 1);
+            }
+        };
+    };
+
+    // jxx target1,x,c1; jxx target2,x,c2
+    template<class Op1, class Op2>
+    struct JumpChain
+    {
+        template<GhcMode Lhs>
+        struct Handler
+        {
+            static int run(Ghost& ghost, const Game&, const GhcDecodedInstruction& instr)
+            {
+                auto value = load<Lhs>(ghost, instr.arg2);
+
+                if(Op1::apply(value, instr.arg3))
+                {
+                    return refund(instr.arg1, 1);
+                }
+
+                if(Op2::apply(value, instr.arg5))
+                {
+                    return proceed(instr.arg4);
+                }
+
+                return proceed(instr.nextPc + 1);
+            }
+        };
+    };
+
+    // Native code calls back here for INT; exceptions can't unwind through it
+    static int interrupt(GhcNativeContext* context, int num)
+    {
+        auto frame = (GhcNativeFrame*)context->user;
+
+        try
+        {
+            frame->ghost->handleInterrupt(*frame->game, num);
+        }
+        catch(...)
+        {
+            frame->error = current_exception();
+            return 1;
+        }
+
+        return 0;
+    }
+
+    // Execution hooks of Ghost::execute(); these compile away
+    struct NoProfiler
+    {
+        static const bool enabled = false;
+
+        static void instruction(Ghost&, uint8_t)
+        {
+        }
+
+        static void finish(Ghost&, int, bool)
+        {
+        }
+    };
+
+    struct Profiler
+    {
+        static const bool enabled = true;
+
+        static void instruction(Ghost& ghost, uint8_t pc)
+        {
+            auto& profile = *ghost._profile;
+            auto& instr = ghost._program->code()[pc];
+            profile.hits[pc]++;
+
+            if(instr.opcode == GhcOpcode::INT)
+            {
+                profile.interrupts[load(ghost, instr.arg1)]++;
+            }
+        }
+
+        static void finish(Ghost& ghost, int instructions, bool halted)
+        {
+            auto& profile = *ghost._profile;
+            profile.steps++;
+            (halted ? profile.halted : profile.exhausted)++;
+            profile.instructions += instructions;
+            profile.maxInstructions = max<uint64_t>(profile.maxInstructions, instructions);
+        }
+    };
+
+    static int hlt(Ghost&, const Game&, const GhcDecodedInstruction&)
+    {
+        return -1;
+    }
+
+    static int storeToPc(Ghost&, const Game&, const GhcDecodedInstruction&)
+    {
+        throw logic_error("cannot store to program counter");
+    }
+
+    static int storeToConstant(Ghost&, const Game&, const GhcDecodedInstruction&)
+    {
+        throw logic_error("cannot store to constant");
+    }
+};
+
+// Maps runtime operand modes onto a handler instantiation, one operand at a time
+template<template<GhcMode...> class Handler, GhcMode... Bound>
+struct GhcSelector
+{
+    static GhcHandler select()
+    {
+        return &Handler<Bound...>::run;
+    }
+
+    template<class... Rest>
+    static GhcHandler select(GhcMode mode, Rest... rest)
+    {
+        switch(mode)
+        {
+            case GhcMode::REGISTER:
+                return GhcSelector<Handler, Bound..., GhcMode::REGISTER>::select(rest...);
+            case GhcMode::CONSTANT:
+                return GhcSelector<Handler, Bound..., GhcMode::CONSTANT>::select(rest...);
+            case GhcMode::INDIRECT_REGISTER:
+                return GhcSelector<Handler, Bound..., GhcMode::INDIRECT_REGISTER>::select(rest...);
+            case GhcMode::INDIRECT_CONSTANT:
+                return GhcSelector<Handler, Bound..., GhcMode::INDIRECT_CONSTANT>::select(rest...);
+        }
+
+        throw logic_error("bad operand mode");
+    }
+};
+
+static bool isJump(GhcOpcode opcode)
+{
+    return opcode == GhcOpcode::JLT || opcode == GhcOpcode::JEQ || opcode == GhcOpcode::JGT;
+}
+
+static bool storesToArg1(GhcOpcode opcode)
+{
+    return !isJump(opcode) && opcode != GhcOpcode::INT && opcode != GhcOpcode::HLT;
+}
+
+static bool readsPc(GhcArgument arg)
+{
+    return arg.isRegister && arg.value == 0;
+}
+
+static GhcHandler selectHandler(const GhcInstruction& instr)
+{
+    auto mode1 = instr.arg1.mode();
+    auto mode2 = instr.arg2.mode();
+    auto mode3 = instr.arg3.mode();
+
+    switch(instr.opcode)
+    {
+        case GhcOpcode::INT:
+            return GhcSelector<GhcOps::Int>::select(mode1);
+        case GhcOpcode::HLT:
+            return &GhcOps::hlt;
+        case GhcOpcode::JLT:
+            return GhcSelector<GhcOps::Jump<GhcLess>::Handler>::select(mode1, mode2, mode3);
+        case GhcOpcode::JEQ:
+            return GhcSelector<GhcOps::Jump<GhcEqual>::Handler>::select(mode1, mode2, mode3);
+        case GhcOpcode::JGT:
+            return GhcSelector<GhcOps::Jump<GhcGreater>::Handler>::select(mode1, mode2, mode3);
+        default:
+            break;
+    }
+
+    // everything else stores to its first argument
+    if(readsPc(instr.arg1))
+    {
+        return &GhcOps::storeToPc;
+    }
+
+    if(mode1 == GhcMode::CONSTANT)
+    {
+        return &GhcOps::storeToConstant;
+    }
+
+    switch(instr.opcode)
+    {
+        case GhcOpcode::MOV:
+            return GhcSelector<GhcOps::Mov>::select(mode1, mode2);
+        case GhcOpcode::INC:
+            return GhcSelector<GhcOps::Step<1>::Handler>::select(mode1);
+        case GhcOpcode::DEC:
+            return GhcSelector<GhcOps::Step<-1>::Handler>::select(mode1);
+        case GhcOpcode::ADD:
+            return GhcSelector<GhcOps::Binary<GhcAdd>::Handler>::select(mode1, mode2);
+        case GhcOpcode::SUB:
+            return GhcSelector<GhcOps::Binary<GhcSub>::Handler>::select(mode1, mode2);
+        case GhcOpcode::MUL:
+            return GhcSelector<GhcOps::Binary<GhcMul>::Handler>::select(mode1, mode2);
+        case GhcOpcode::DIV:
+            return GhcSelector<GhcOps::Binary<GhcDiv>::Handler>::select(mode1, mode2);
+        case GhcOpcode::AND:
+            return GhcSelector<GhcOps::Binary<GhcAnd>::Handler>::select(mode1, mode2);
+        case GhcOpcode::OR:
+            return GhcSelector<GhcOps::Binary<GhcOr>::Handler>::select(mode1, mode2);
+        case GhcOpcode::XOR:
+            return GhcSelector<GhcOps::Binary<GhcXor>::Handler>::select(mode1, mode2);
+        default:
+            break;
+    }
+
+    throw logic_error("bad opcode");
+}
+
+static vector<GhcDecodedInstruction> decode(const vector<GhcInstruction>& code)
+{
+    auto program = vector<GhcDecodedInstruction> {};
+    program.reserve(code.size());
+
+    for(auto i = 0u; i < code.size(); i++)
+    {
+        auto& instr = code[i];
+
+        program.push_back({
+            selectHandler(instr),
+            instr.arg1.value,
+            instr.arg2.value,
+            instr.arg3.value,
+            0,
+            0,
+            (uint8_t)(i + 1),
+            1
+        });
+    }
+
+    return program;
+}
+
+template<class Op>
+static bool compare(const GhcInstruction& instr)
+{
+    return Op::apply(instr.arg2.value, instr.arg3.value);
+}
+
+static bool sameArgument(GhcArgument a, GhcArgument b)
+{
+    return a.isIndirect == b.isIndirect && a.isRegister == b.isRegister && a.value == b.value;
+}
+
+static bool isConstant(GhcArgument arg, int value)
+{
+    return arg.mode() == GhcMode::CONSTANT && arg.value == value;
+}
+
+// Whether a jump's outcome is known without running it
+static bool decideJump(const GhcInstruction& instr, bool& taken)
+{
+    if(instr.arg2.mode() == GhcMode::CONSTANT && instr.arg3.mode() == GhcMode::CONSTANT)
+    {
+        taken = instr.opcode == GhcOpcode::JLT ? compare<GhcLess>(instr) :
+            instr.opcode == GhcOpcode::JEQ ? compare<GhcEqual>(instr) :
+            compare<GhcGreater>(instr);
+        return true;
+    }
+
+    if(sameArgument(instr.arg2, instr.arg3))
+    {
+        taken = instr.opcode == GhcOpcode::JEQ;
+        return true;
+    }
+
+    return false;
+}
+
+// Replaces an instruction with a cheaper one of identical effect, if any
+static bool fold(const GhcInstruction& instr, GhcDecodedInstruction& decoded)
+{
+    if(isJump(instr.opcode))
+    {
+        auto taken = false;
+        auto decided = decideJump(instr, taken);
+
+        if(decided)
+        {
+            decoded.handler = taken ? GhcSelector<GhcOps::Goto>::select(instr.arg1.mode()) : &GhcOps::nop;
+        }
+
+        return decided;
+    }
+
+    // faulting stores must still fault
+    if(!storesToArg1(instr.opcode) || readsPc(instr.arg1) || instr.arg1.mode() == GhcMode::CONSTANT)
+    {
+        return false;
+    }
+
+    auto dest = instr.arg1;
+    auto src = instr.arg2;
+
+    switch(instr.opcode)
+    {
+        case GhcOpcode::MOV:
+            if(sameArgument(dest, src))
+            {
+                decoded.handler = &GhcOps::nop;
+                return true;
+            }
+            break;
+        case GhcOpcode::ADD:
+        case GhcOpcode::SUB:
+        case GhcOpcode::OR:
+        case GhcOpcode::XOR:
+            if(isConstant(src, 0))
+            {
+                decoded.handler = &GhcOps::nop;
+                return true;
+            }
+            break;
+        case GhcOpcode::MUL:
+        case GhcOpcode::DIV:
+            if(isConstant(src, 1))
+            {
+                decoded.handler = &GhcOps::nop;
+                return true;
+            }
+            break;
+        case GhcOpcode::AND:
+            if(isConstant(src, 255))
+            {
+                decoded.handler = &GhcOps::nop;
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+
+    // x - x, x ^ x, x * 0 and x & 0 all store zero
+    auto storesZero =
+        ((instr.opcode == GhcOpcode::SUB || instr.opcode == GhcOpcode::XOR) && sameArgument(dest, src)) ||
+        ((instr.opcode == GhcOpcode::MUL || instr.opcode == GhcOpcode::AND) && isConstant(src, 0));
+
+    if(storesZero)
+    {
+        decoded.handler = GhcSelector<GhcOps::Mov>::select(dest.mode(), GhcMode::CONSTANT);
+        decoded.arg2 = 0;
+        return true;
+    }
+
+    return false;
+}
+
+template<int Delta>
+static GhcHandler selectStepJump(const GhcInstruction& jump)
+{
+    auto lhs = jump.arg2.mode();
+    auto rhs = jump.arg3.mode();
+
+    switch(jump.opcode)
+    {
+        case GhcOpcode::JLT:
+            return GhcSelector<GhcOps::StepJump<Delta, GhcLess>::template Handler>::select(lhs, rhs);
+        case GhcOpcode::JEQ:
+            return GhcSelector<GhcOps::StepJump<Delta, GhcEqual>::template Handler>::select(lhs, rhs);
+        default:
+            return GhcSelector<GhcOps::StepJump<Delta, GhcGreater>::template Handler>::select(lhs, rhs);
+    }
+}
+
+template<class Op1>
+static GhcHandler selectJumpChain(const GhcInstruction& second, GhcMode lhs)
+{
+    switch(second.opcode)
+    {
+        case GhcOpcode::JLT:
+            return GhcSelector<GhcOps::JumpChain<Op1, GhcLess>::template Handler>::select(lhs);
+        case GhcOpcode::JEQ:
+            return GhcSelector<GhcOps::JumpChain<Op1, GhcEqual>::template Handler>::select(lhs);
+        default:
+            return GhcSelector<GhcOps::JumpChain<Op1, GhcGreater>::template Handler>::select(lhs);
+    }
+}
+
+// Builds a superinstruction for the pair starting at first, if any. It
+// never reads PC between its parts, except to set it before an INT.
+static bool fuse(const GhcInstruction& first, const GhcInstruction& second, GhcDecodedInstruction& fused)
+{
+    auto isPlainRegister = first.arg1.mode() == GhcMode::REGISTER && !readsPc(first.arg1);
+
+    if(first.opcode == GhcOpcode::MOV && isPlainRegister &&
+       second.opcode == GhcOpcode::INT && second.arg1.mode() == GhcMode::CONSTANT)
+    {
+        fused.handler = GhcSelector<GhcOps::MovInt>::select(first.arg2.mode());
+        fused.arg1 = first.arg1.value;
+        fused.arg2 = first.arg2.value;
+        fused.arg3 = second.arg1.value;
+        return true;
+    }
+
+    auto isStaticJump = isJump(second.opcode) && second.arg1.mode() == GhcMode::CONSTANT &&
+        !readsPc(second.arg2) && !readsPc(second.arg3);
+
+    if((first.opcode == GhcOpcode::INC || first.opcode == GhcOpcode::DEC) && isPlainRegister && isStaticJump)
+    {
+        fused.handler = first.opcode == GhcOpcode::INC ? selectStepJump<1>(second) : selectStepJump<-1>(second);
+        fused.arg1 = first.arg1.value;
+        fused.arg2 = second.arg2.value;
+        fused.arg3 = second.arg3.value;
+        fused.arg4 = second.arg1.value;
+        return true;
+    }
+
+    auto isChain = isJump(first.opcode) && first.arg1.mode() == GhcMode::CONSTANT && isStaticJump &&
+        !readsPc(first.arg2) && sameArgument(first.arg2, second.arg2) &&
+        first.arg3.mode() == GhcMode::CONSTANT && second.arg3.mode() == GhcMode::CONSTANT;
+
+    if(isChain)
+    {
+        auto lhs = first.arg2.mode();
+
+        fused.handler = first.opcode == GhcOpcode::JLT ? selectJumpChain<GhcLess>(second, lhs) :
+            first.opcode == GhcOpcode::JEQ ? selectJumpChain<GhcEqual>(second, lhs) :
+            selectJumpChain<GhcGreater>(second, lhs);
+        fused.arg1 = first.arg1.value;
+        fused.arg2 = first.arg2.value;
+        fused.arg3 = first.arg3.value;
+        fused.arg4 = second.arg1.value;
+        fused.arg5 = second.arg3.value;
+        return true;
+    }
+
+    return false;
+}
+
+// Folds constant operands in place, then builds the superinstruction table;
+// every slot keeps its own PC so jump targets are unaffected
+static GhcOptimizerStats optimize(const vector<GhcInstruction>& code,
+    vector<GhcDecodedInstruction>& program,
+    vector<GhcDecodedInstruction>& fused)
+{
+    auto stats = GhcOptimizerStats {(int)code.size(), 0, 0};
+
+    for(auto i = 0u; i < code.size(); i++)
+    {
+        if(fold(code[i], program[i]))
+        {
+            stats.folded++;
+        }
+    }
+
+    fused = program;
+
+    for(auto i = 0u; i + 1 < code.size(); i++)
+    {
+        if(fuse(code[i], code[i + 1], fused[i]))
+        {
+            fused[i].cost = 2;
+            stats.fused++;
+        }
+    }
+
+    return stats;
+}
+
+// Proves that a program never leaves its code, never stores to PC or a
+// constant and never addresses memory outside dataSize bytes, so it can
+// run without per-instruction checks
+static bool verify(const vector<GhcInstruction>& code, size_t dataSize)
+{
+    auto size = code.size();
+
+    if(size == 0)
+    {
+        return false;
+    }
+
+    // PC is 8 bits wide, so a full program can't leave its code
+    auto isFull = size == 256;
+
+    for(auto& instr : code)
+    {
+        if(storesToArg1(instr.opcode) && (readsPc(instr.arg1) || instr.arg1.mode() == GhcMode::CONSTANT))
+        {
+            return false;
+        }
+
+        for(auto arg : {instr.arg1, instr.arg2, instr.arg3})
+        {
+            auto maxAddress = arg.isRegister ? 255u : arg.value;
+
+            if(arg.isIndirect && maxAddress >= dataSize)
+            {
+                return false;
+            }
+        }
+
+        if(isJump(instr.opcode) && !isFull)
+        {
+            if(instr.arg1.mode() != GhcMode::CONSTANT || instr.arg1.value >= size)
+            {
+                return false;
+            }
+        }
+    }
+
+    // falling off the last instruction leaves the code
+    auto& last = code.back();
+    auto taken = false;
+    auto fallsThrough = last.opcode != GhcOpcode::HLT && !(isJump(last.opcode) && decideJump(last, taken) && taken);
+
+    return isFull || !fallsThrough;
+}
+
+static string formatArgument(GhcArgument arg)
+{
+    auto str = string {};
+
+    if(arg.isRegister)
+    {
+        str = arg.value == 0 ? "pc" : string(1, 'a' + arg.value - 1);
+    }
+    else
+    {
+        str = to_string(arg.value);
+    }
+
+    return arg.isIndirect ? "[" + str + "]" : str;
+}
+
+string formatInstruction(const GhcInstruction& instr)
+{
+    static const char* mnemonics[] =
+    {
+        "mov", "inc", "dec", "add", "sub", "mul", "div", "and",
+        "or",  "xor", "jlt", "jeq", "jgt", "int", "hlt"
+    };
+
+    auto str = string {mnemonics[(int)instr.opcode]};
+
+    switch(instr.opcode)
+    {
+        case GhcOpcode::HLT:
+            break;
+        case GhcOpcode::INC:
+        case GhcOpcode::DEC:
+        case GhcOpcode::INT:
+            str += " " + formatArgument(instr.arg1);
+            break;
+        case GhcOpcode::JLT:
+        case GhcOpcode::JEQ:
+        case GhcOpcode::JGT:
+            str += " " + formatArgument(instr.arg1) + "," + formatArgument(instr.arg2) + "," + formatArgument(instr.arg3);
+            break;
+        default:
+            str += " " + formatArgument(instr.arg1) + "," + formatArgument(instr.arg2);
+            break;
+    }
+
+    return str;
+}
+
+// Whether module was translated from code, and not just from a source
+// with the same hash
+static bool translatedFrom(const GhcCompiledModule& module, const vector<GhcInstruction>& code)
+{
+    return module.size == (int)code.size() &&
+        memcmp(module.code, code.data(), code.size() * sizeof(GhcInstruction)) == 0;
+}
+
+GhcProgram::GhcProgram(const vector<GhcInstruction>& code, uint64_t hash) :
+    _hash(hash),
+    _code(code),
+    _decoded(decode(_code)),
+    _module(findCompiledModule(_hash))
+{
+    if(_module && !translatedFrom(*_module, _code))
+    {
+        _module = nullptr;
+    }
+
+    _optimizerStats = optimize(_code, _decoded, _fused);
+    _verified = verify(_code, GHC_DATA_SIZE);
+}
 
-static GhcOpcode parseOpcode(const string& str)
+// Builds a program from GHC source or a .ghcb binary
+static shared_ptr<const GhcProgram> assemble(const MappedFile& file, uint64_t hash)
 {
-    if(str == "mov") { return GhcOpcode::MOV; }
-    else if(str == "inc") { return GhcOpcode::INC; }
-    else if(str == "dec") { return GhcOpcode::DEC; }
-    else if(str == "add") { return GhcOpcode::ADD; }
-    else if(str == "sub") { return GhcOpcode::SUB; }
-    else if(str == "mul") { return GhcOpcode::MUL; }
-    else if(str == "div") { return GhcOpcode::DIV; }
-    else if(str == "and") { return GhcOpcode::AND; }
-    else if(str == "or") { return GhcOpcode::OR; }
-    else if(str == "xor") { return GhcOpcode::XOR; }
-    else if(str == "jlt") { return GhcOpcode::JLT; }
-    else if(str == "jeq") { return GhcOpcode::JEQ; }
-    else if(str == "jgt") { return GhcOpcode::JGT; }
-    else if(str == "int") { return GhcOpcode::INT; }
-    else if(str == "hlt") { return GhcOpcode::HLT; }
+    if(isBinaryProgram(file.data(), file.size()))
+    {
+        GhcBinaryHeader header;
+        auto code = readBinaryProgram(file.data(), file.size(), header);
+
+        return make_shared<GhcProgram>(vector<GhcInstruction>(code, code + header.size), header.sourceHash);
+    }
 
-    throw runtime_error("unknown opcode");
+    GhcInstruction code[GHC_MAX_PROGRAM_SIZE];
+    auto size = assembleProgram(file.data(), file.size(), code);
+
+    return make_shared<GhcProgram>(vector<GhcInstruction>(code, code + size), hash);
 }
 
-static GhcArgument parseArgument(const string& str)
+shared_ptr<const GhcProgram> GhcProgram::load(const string& path)
 {
-    auto arg = GhcArgument {false, false, 0};
+    // weak, so a program goes once the last ghost running it does
+    static mutex lock;
+    static map<pair<string, uint64_t>, weak_ptr<const GhcProgram>> programs;
 
-    auto pos = 0u;
+    MappedFile file(path);
+    auto key = make_pair(path, hashProgram(file.data(), file.size()));
 
-    if(pos + 1 > str.size())
     {
-        return arg;
+        lock_guard<mutex> guard(lock);
+        auto it = programs.find(key);
+
+        if(it != programs.end())
+        {
+            if(auto program = it->second.lock())
+            {
+                return program;
+            }
+        }
     }
 
-    if(str[pos] == '[')
+    // assembling takes a while, so other paths load meanwhile; if another
+    // thread assembles the same program first, its copy wins
+    auto program = shared_ptr<const GhcProgram>();
+
+    try
+    {
+        program = assemble(file, key.second);
+    }
+    catch(const runtime_error& e)
     {
-        arg.isIndirect = true;
-        pos++;
+        throw runtime_error(path + ": " + e.what());
     }
 
-    if(pos + 1 > str.size())
+    lock_guard<mutex> guard(lock);
+
+    for(auto it = programs.begin(); it != programs.end();)
     {
-        throw runtime_error("argument too short");
+        it = it->second.expired() ? programs.erase(it) : next(it);
     }
 
-    if(str[pos] >= 'a' && str[pos] <= 'h')
+    auto& cached = programs[key];
+
+    if(auto winner = cached.lock())
     {
-        arg.isRegister = true;
-        arg.value = str[pos] - 'a' + 1;
+        return winner;
     }
-    else if(str[pos] == 'p')
+
+    cached = program;
+    return program;
+}
+
+uint64_t GhcProgram::hash() const
+{
+    return _hash;
+}
+
+const vector<GhcInstruction>& GhcProgram::code() const
+{
+    return _code;
+}
+
+const GhcOptimizerStats& GhcProgram::optimizerStats() const
+{
+    return _optimizerStats;
+}
+
+bool GhcProgram::verified() const
+{
+    return _verified;
+}
+
+GhcNativeEntry GhcProgram::native(GhcEngine engine) const
+{
+    if(engine == GhcEngine::INTERPRETER)
     {
-        arg.isRegister = true;
-        arg.value = 0;
+        return nullptr;
     }
-    else
+
+    // code translated ahead of time beats the JIT
+    if(_module)
     {
-        arg.value = atoi(str.c_str() + pos);
+        return _module->entry;
     }
 
-    return arg;
+    call_once(_jitCompiled, [this]() { _jit = GhcJit::compile(_code); });
+    return _jit ? _jit->entry() : nullptr;
 }
 
-void Ghost::init(int ghostNum, Position pos, istream& is)
+void Ghost::init(int ghostNum, shared_ptr<const GhcProgram> program, GhcEngine engine)
 {
     _ghostNum = ghostNum;
-    _startPosition = pos;
-    _position = pos;
     _direction = Direction::DOWN;
-    _invisible = false;
 
-    if(!is)
-    {
-        throw runtime_error("bad input stream");
-    }
+    fill(begin(_registers), end(_registers), 0);
+    fill(begin(_data), end(_data), 0);
+    _program = program;
+    _engine = engine;
+    _native = _program->native(engine);
+    _profile.reset();
+    _memo.reset();
+    _trace = nullptr;
+    _silent = false;
+}
 
-    _registers.clear();
-    _registers.resize(9); // PC, A-H
-    _data.clear();
-    _data.resize(0xFF);
-    _code.clear();
+Ghost Ghost::shadow() const
+{
+    auto copy = *this;
+    copy._profile.reset();
+    copy._memo.reset();
+    copy._trace = nullptr;
+    copy._silent = true;
 
-    while(is)
-    {
-        string str;
-        getline(is, str);
+    return copy;
+}
 
-        // remove comments
-        auto commentPos = str.find(';');
+bool Ghost::sameState(const Ghost& other) const
+{
+    return equal(begin(_registers), end(_registers), other._registers) &&
+        equal(begin(_data), end(_data), other._data) &&
+        _direction == other._direction;
+}
 
-        if(commentPos != string::npos)
-        {
-            str = str.substr(0, commentPos);
-        }
+const GhcProgram& Ghost::program() const
+{
+    return *_program;
+}
 
-        // lowercase and remove commas
-        for(auto& c : str)
-        {
-            c = tolower(c);
+shared_ptr<const GhcProgram> Ghost::sharedProgram() const
+{
+    return _program;
+}
 
-            if(c == ',')
-            {
-                c = ' ';
-            }
-        }
+const uint8_t* Ghost::registers() const
+{
+    return _registers;
+}
 
-        auto mnemonic = string {};
-        auto arg1 = string {};
-        auto arg2 = string {};
-        auto arg3 = string {};
-        stringstream(str) >> mnemonic >> arg1 >> arg2 >> arg3;
+const uint8_t* Ghost::data() const
+{
+    return _data;
+}
 
-        if(mnemonic.empty())
-        {
-            continue;
-        }
+void Ghost::restore(const uint8_t* registers, const uint8_t* data)
+{
+    copy_n(registers, sizeof(_registers), _registers);
+    copy_n(data, GHC_DATA_SIZE, _data);
+}
 
-        _code.push_back({
-            parseOpcode(mnemonic),
-            parseArgument(arg1),
-            parseArgument(arg2),
-            parseArgument(arg3)
-        });
-    }
+const GhcProfile* Ghost::profile() const
+{
+    return _profile.get();
+}
+
+void Ghost::enableProfiling()
+{
+    _profile = make_shared<GhcProfile>();
+    _native = nullptr;
+}
+
+void Ghost::enableTracing(GhcTraceBuffer& buffer)
+{
+    _trace = &buffer;
 }
 
-void Ghost::step(const Game& game)
+const GhcMemo* Ghost::memo() const
 {
-    run(game);
+    return _memo.get();
+}
+
+void Ghost::enableMemo(int validateEvery)
+{
+    _memo = make_shared<GhcMemo>(validateEvery);
+}
 
-    Direction directions[] =
+Direction Ghost::run(const Game& game, Direction direction)
+{
+    _direction = direction;
+
+    auto memoized = _memo && !_profile;
+
+    if(memoized && replay(game))
     {
-        _direction,
-        Direction::UP,
-        Direction::RIGHT,
-        Direction::DOWN,
-        Direction::LEFT
-    };
+        return _direction;
+    }
 
-    for(auto i = 0u; i < sizeof(directions)/sizeof(directions[0]); i++)
+    if(!_native)
+    {
+        interpret(game, GHC_MAX_INSTR_COUNT);
+    }
+    else if(_engine == GhcEngine::DIFFERENTIAL)
+    {
+        runDifferential(game);
+    }
+    else
     {
-        auto newPos = _position.move(directions[i]);
+        runNative(game);
+    }
 
-        if(game.map().get(newPos) != '#')
-        {
-            _direction = directions[i];
-            _position = newPos;
-            break;
-        }
+    if(memoized)
+    {
+        _memo->finish(_registers, _data, _direction);
     }
+
+    return _direction;
 }
 
-void Ghost::reset()
+void Ghost::interpret(const Game& game, int fuel)
 {
-    _position = _startPosition;
+    auto checked = !_program->_verified;
+
+    if(_profile)
+    {
+        checked ? execute<true, GhcOps::Profiler>(game, fuel) : execute<false, GhcOps::Profiler>(game, fuel);
+    }
+    else
+    {
+        checked ? execute<true, GhcOps::NoProfiler>(game, fuel) : execute<false, GhcOps::NoProfiler>(game, fuel);
+    }
 }
 
-void Ghost::setInvisible(bool newInvisible)
+template<bool Checked, class Profiler>
+void Ghost::execute(const Game& game, int fuel)
 {
-    _invisible = newInvisible;
+    auto budget = fuel;
+    auto size = _program->_decoded.size();
+    auto decoded = _program->_decoded.data();
+    auto fused = _program->_fused.data();
+
+    while(fuel > 0)
+    {
+        auto pc = _registers[0];
+
+        if(Checked && pc >= size)
+        {
+            throw runtime_error("program counter out of range");
+        }
+
+        // a superinstruction only runs if all of it fits in the fuel left;
+        // none costs more than 2. The profiler counts plain instructions.
+        auto table = fuel > 1 && !Profiler::enabled ? fused : decoded;
+        auto instr = &table[pc];
+
+        Profiler::instruction(*this, pc);
+        auto result = instr->handler(*this, game, *instr);
+        fuel -= instr->cost;
+
+        if(result & ~0xFF)
+        {
+            if(result < 0)
+            {
+                Profiler::finish(*this, budget - fuel - instr->cost, true);
+                return;
+            }
+
+            fuel += result >> 8;
+        }
+
+        _registers[0] = (uint8_t)result;
+    }
+
+    Profiler::finish(*this, budget - fuel, false);
 }
 
-Position Ghost::position() const
+void Ghost::runNative(const Game& game)
 {
-    return _position;
+    auto frame = GhcNativeFrame {this, &game, nullptr};
+    auto context = GhcNativeContext {_registers, _data, GHC_MAX_INSTR_COUNT, &GhcOps::interrupt, &frame};
+
+    switch((GhcNativeStatus)_native(&context))
+    {
+        case GhcNativeStatus::HALTED:
+            break;
+        case GhcNativeStatus::CONTINUE:
+            interpret(game, context.fuel);
+            break;
+        case GhcNativeStatus::FAILED:
+            rethrow_exception(frame.error);
+    }
 }
 
-bool Ghost::invisible() const
+void Ghost::runDifferential(const Game& game)
 {
-    return _invisible;
+    auto expected = shadow();
+    expected.interpret(game, GHC_MAX_INSTR_COUNT);
+
+    runNative(game);
+
+    if(!sameState(expected))
+    {
+        throw logic_error("native code diverged from the interpreter");
+    }
 }
 
-void Ghost::run(const Game& game)
+// Replays the step from the memo if it has been taken from this state
+// with the game looking the same to it, or else starts recording it
+bool Ghost::replay(const Game& game)
 {
-    auto stepCount = 0;
+    auto& memo = *_memo;
+    GhcMemoKey key;
+    copy(begin(_registers), end(_registers), key.registers);
+    copy(begin(_data), end(_data), key.data);
+    key.direction = (uint8_t)_direction;
 
-    while(stepCount < MAX_INSTR_COUNT)
+    auto node = memo.find(key);
+
+    while(node >= 0 && memo.node(node).kind == GhcMemoNode::READ)
     {
-        auto nextPc = _registers[0];
-        auto instr = _code[nextPc++];
+        auto observation = memo.node(node).read;
+        read(game, observation);
+        node = memo.next(node, observation.out);
+    }
 
-        switch(instr.opcode)
-        {
-            case GhcOpcode::MOV:
-                store(instr.arg1, load(instr.arg2));
-                break;
-            case GhcOpcode::INC:
-                store(instr.arg1, load(instr.arg1) + 1);
-                break;
-            case GhcOpcode::DEC:
-                store(instr.arg1, load(instr.arg1) - 1);
-                break;
-            case GhcOpcode::ADD:
-                store(instr.arg1, load(instr.arg1) + load(instr.arg2));
-                break;
-            case GhcOpcode::SUB:
-                store(instr.arg1, load(instr.arg1) - load(instr.arg2));
-                break;
-            case GhcOpcode::MUL:
-                store(instr.arg1, load(instr.arg1) * load(instr.arg2));
-                break;
-            case GhcOpcode::DIV:
-                store(instr.arg1, load(instr.arg1) / load(instr.arg2));
-                break;
-            case GhcOpcode::AND:
-                store(instr.arg1, load(instr.arg1) & load(instr.arg2));
-                break;
-            case GhcOpcode::OR:
-                store(instr.arg1, load(instr.arg1) | load(instr.arg2));
-                break;
-            case GhcOpcode::XOR:
-                store(instr.arg1, load(instr.arg1) ^ load(instr.arg2));
-                break;
-            case GhcOpcode::JLT:
-                if(load(instr.arg2) < load(instr.arg3))
-                {
-                    nextPc = load(instr.arg1);
-                }
-                break;
-            case GhcOpcode::JEQ:
-                if(load(instr.arg2) == load(instr.arg3))
-                {
-                    nextPc = load(instr.arg1);
-                }
-                break;
-            case GhcOpcode::JGT:
-                if(load(instr.arg2) > load(instr.arg3))
-                {
-                    nextPc = load(instr.arg1);
-                }
-                break;
-            case GhcOpcode::INT:
-                handleInterrupt(game, load(instr.arg1));
-                break;
-            case GhcOpcode::HLT:
-                return;
-        }
+    if(node < 0 || memo.node(node).kind != GhcMemoNode::OUTCOME)
+    {
+        memo.begin(key);
+        return false;
+    }
+
+    auto& outcome = memo.node(node);
+    auto validate = memo.hit();
+    auto expected = Ghost();
 
-        _registers[0] = nextPc;
-        stepCount++;
+    if(validate)
+    {
+        expected = shadow();
+        expected.run(game, _direction);
+    }
+
+    copy(begin(outcome.registers), end(outcome.registers), _registers);
+    _direction = outcome.direction;
+
+    for(auto i = outcome.writesBegin; i != outcome.writesEnd; i++)
+    {
+        _data[memo.writes()[i].address] = memo.writes()[i].value;
+    }
+
+    if(validate && !sameState(expected))
+    {
+        throw logic_error("memoized step diverged from the program");
     }
+
+    return true;
 }
 
 void Ghost::handleInterrupt(const Game& game, int num)
@@ -257,48 +1176,122 @@ void Ghost::handleInterrupt(const Game& game, int num)
             }
             break;
         case 1:
-            // get player position
-            _registers[1] = game.player().position().x;
-            _registers[2] = game.player().position().y;
+        case 3:
+        case 4:
+        case 5:
+        case 7:
+            observe(game, num);
             break;
         case 2:
             // get player 2 position
             break;
+        case 6:
+            // get ghost direction and vitality
+            _registers[1] = (uint8_t)_direction;
+            observe(game, num);
+            break;
+        case 8:
+            // trace
+            if(_silent)
+            {
+                break;
+            }
+
+            // a replayed step would not trace
+            if(_memo)
+            {
+                _memo->spoil();
+            }
+
+            if(_trace)
+            {
+                auto record = GhcTraceRecord {game.clock().value, (uint16_t)_ghostNum, _registers[0], {}, 0};
+                copy(begin(_registers) + 1, end(_registers), record.registers);
+                _trace->push(record);
+                break;
+            }
+
+            // one write, so ghosts running in parallel don't interleave
+            {
+                auto line = string {"register dump:"};
+
+                for(auto r : _registers)
+                {
+                    line += ' ';
+                    line += (char)r;
+                }
+
+                cerr << line + '\n';
+            }
+            break;
+        default:
+            throw runtime_error("unknown interrupt");
+    }
+}
+
+// Interrupts that read the game come through here, so a memo recording the
+// step sees what they returned
+void Ghost::observe(const Game& game, int num)
+{
+    auto observation = GhcObservation {(uint8_t)num, {_registers[1], _registers[2]}, {}};
+    read(game, observation);
+
+    _registers[1] = observation.out[0];
+    _registers[2] = observation.out[1];
+
+    if(_memo)
+    {
+        _memo->record(observation);
+    }
+}
+
+// Fills in what interrupt observation.num returns in A and B given in
+void Ghost::read(const Game& game, GhcObservation& observation) const
+{
+    auto& out = observation.out;
+    out[0] = observation.in[0];
+    out[1] = observation.in[1];
+
+    switch(observation.num)
+    {
+        case 1:
+            // get player position
+            out[0] = game.player().position().x;
+            out[1] = game.player().position().y;
+            break;
         case 3:
             // get ghost index
-            _registers[1] = _ghostNum;
+            out[0] = _ghostNum;
             break;
         case 4:
             // get ghost start pos
-            _registers[1] = _startPosition.x;
-            _registers[2] = _startPosition.y;
+            out[0] = game.ghosts().startPosition(_ghostNum).x;
+            out[1] = game.ghosts().startPosition(_ghostNum).y;
             break;
         case 5:
             // get ghost current pos
-            _registers[1] = _position.x;
-            _registers[2] = _position.y;
+            out[0] = game.ghosts().position(_ghostNum).x;
+            out[1] = game.ghosts().position(_ghostNum).y;
             break;
         case 6:
-            // get ghost direction and vitality
-            _registers[1] = (uint8_t)_direction;
-
-            if(_invisible)
+            // get ghost vitality; A already holds the direction
+            if(game.ghosts().invisible(_ghostNum))
             {
-                _registers[2] = 2;
+                out[1] = 2;
             }
             else if(game.frightMode())
             {
-                _registers[2] = 1;
+                out[1] = 1;
             }
             else
             {
-                _registers[2] = 0;
+                out[1] = 0;
             }
             break;
         case 7:
             // get map square
             {
-                auto pos = Position { _registers[1], _registers[2] };
+                auto pos = Position { out[0], out[1] };
                 auto ch = '#';
                 auto value = uint8_t {};
 
@@ -332,67 +1325,8 @@ void Ghost::handleInterrupt(const Game& game, int num)
                         break;
                 }
 
-                _registers[1] = value;
-            }
-            break;
-        case 8:
-            // trace
-            cerr << "register dump:";
-            for(auto r : _registers)
-            {
-                cerr << " " << r;
+                out[0] = value;
             }
-            cerr << endl;
             break;
-        default:
-            throw runtime_error("unknown interrupt");
-    }
-}
-
-uint8_t Ghost::load(GhcArgument arg) const
-{
-    auto value = arg.value;
-
-    if(arg.isRegister)
-    {
-        value = _registers[value];
-    }
-
-    if(arg.isIndirect)
-    {
-        value = _data[value];
     }
-
-    return value;
 }
-
-void Ghost::store(GhcArgument arg, uint8_t value)
-{
-    if(arg.isRegister && arg.value == 0)
-    {
-        throw logic_error("cannot store to program counter");
-    }
-
-    if(arg.isIndirect)
-    {
-        if(arg.isRegister)
-        {
-            _data[_registers[arg.value]] = value;
-        }
-        else
-        {
-            _data[arg.value] = value;
-        }
-    }
-    else
-    {
-        if(arg.isRegister)
-        {
-            _registers[arg.value] = value;
-        }
-        else
-        {
-            throw logic_error("cannot store to constant");
-        }
-    }
-}
\ No newline at end of file
@@ -3,7 +3,10 @@
 
 #include "basic.hpp"
 #include "map.hpp"
+#include "native.hpp"
 #include <iostream>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 
@@ -13,11 +16,30 @@ enum class GhcOpcode : uint8_t
     OR,  XOR, JLT, JEQ, JGT, INT, HLT
 };
 
+// Operand addressing modes, resolved once when a program is decoded
+enum class GhcMode : uint8_t
+{
+    REGISTER,
+    CONSTANT,
+    INDIRECT_REGISTER,
+    INDIRECT_CONSTANT
+};
+
 struct GhcArgument
 {
     bool isIndirect;
     bool isRegister;
     uint8_t value;
+
+    GhcMode mode() const
+    {
+        if(isIndirect)
+        {
+            return isRegister ? GhcMode::INDIRECT_REGISTER : GhcMode::INDIRECT_CONSTANT;
+        }
+
+        return isRegister ? GhcMode::REGISTER : GhcMode::CONSTANT;
+    }
 };
 
 struct GhcInstruction
@@ -28,35 +50,167 @@ struct GhcInstruction
     GhcArgument arg3;
 };
 
+// bytes of data memory per ghost
+static const int GHC_DATA_SIZE = 256;
+// instructions a ghost may execute per move
+static const int GHC_MAX_INSTR_COUNT = 1024;
+
+// How ghost programs are executed; a compiled module from ghc2cpp takes
+// the place of the JIT's native code
+enum class GhcEngine
+{
+    INTERPRETER,
+    // native code, falling back to the interpreter where unavailable
+    JIT,
+    // native code checked against the interpreter after every step
+    DIFFERENTIAL
+};
+
 class Game;
+class Ghost;
+class GhcJit;
+struct GhcDecodedInstruction;
+struct GhcProfile;
+class GhcTraceBuffer;
+class GhcMemo;
+struct GhcObservation;
+
+// Executes one decoded instruction or superinstruction, returning the next
+// PC, or -1 to halt. A superinstruction that leaves early adds the number of
+// instructions it skipped shifted left by 8.
+typedef int (*GhcHandler)(Ghost& ghost, const Game& game, const GhcDecodedInstruction& instr);
+
+struct GhcDecodedInstruction
+{
+    GhcHandler handler;
+    uint8_t arg1;
+    uint8_t arg2;
+    uint8_t arg3;
+    // extra operands of superinstructions
+    uint8_t arg4;
+    uint8_t arg5;
+    uint8_t nextPc;
+    // instructions charged if it runs to completion
+    uint8_t cost;
+};
+
+struct GhcOptimizerStats
+{
+    int instructions;
+    // instructions replaced by a cheaper equivalent
+    int folded;
+    // instructions starting a two-instruction superinstruction
+    int fused;
+};
 
+string formatInstruction(const GhcInstruction& instr);
+
+// A parsed, verified and optimized ghost program. Immutable once built, so
+// every ghost running it, in any game, shares one instance.
+class GhcProgram
+{
+public:
+    // hash identifies the source, to find a compiled module for it; one
+    // translated from other code is ignored
+    GhcProgram(const vector<GhcInstruction>& code, uint64_t hash);
+
+    // Returns the program held in the file at path, GHC source or .ghcb,
+    // assembling it only if no program loaded from that path with those
+    // contents is still in use. Thread safe.
+    static shared_ptr<const GhcProgram> load(const string& path);
+
+    uint64_t hash() const;
+    const vector<GhcInstruction>& code() const;
+    const GhcOptimizerStats& optimizerStats() const;
+    // whether the program runs without runtime checks
+    bool verified() const;
+    // Native code for the program under engine, or null to interpret it
+    GhcNativeEntry native(GhcEngine engine) const;
+
+private:
+    GhcProgram(const GhcProgram&);
+    GhcProgram& operator=(const GhcProgram&);
+
+    friend class Ghost;
+
+    uint64_t _hash;
+    vector<GhcInstruction> _code;
+    vector<GhcDecodedInstruction> _decoded;
+    vector<GhcDecodedInstruction> _fused;
+    GhcOptimizerStats _optimizerStats;
+    bool _verified;
+    const GhcCompiledModule* _module;
+    // compiled the first time a ghost asks for the JIT
+    mutable once_flag _jitCompiled;
+    mutable shared_ptr<const GhcJit> _jit;
+};
+
+// The VM of one ghost. Where the ghost is lives in GhostPool; this holds
+// its program and memory, inline so a pool of ghosts is one block.
 class Ghost
 {
 public:
-    void init(int ghostNum, Position pos, istream& is);
+    void init(int ghostNum, shared_ptr<const GhcProgram> program,
+        GhcEngine engine = GhcEngine::INTERPRETER);
 
-    void step(const Game& game);
-    void setInvisible(bool newInvisible);
-    void reset();
+    // Runs the program for one move and returns the direction it chose,
+    // starting from the direction the ghost is facing
+    Direction run(const Game& game, Direction direction);
+    // Collects a GhcProfile from now on; profiled ghosts are always
+    // interpreted, one plain instruction at a time
+    void enableProfiling();
+    // Sends int 8 records to buffer instead of stderr
+    void enableTracing(GhcTraceBuffer& buffer);
+    // Replays steps from a GhcMemo where it can, checking every nth hit
+    // against the program if validateEvery is above 0. Not while profiling.
+    void enableMemo(int validateEvery);
 
-    Position position() const;
-    bool invisible() const;
+    // A copy that runs the same but reports nothing: no profile, trace or
+    // register dumps. Used to check other ways of running the ghost.
+    Ghost shadow() const;
+    // whether both VMs are in the same state
+    bool sameState(const Ghost& other) const;
+
+    const GhcProgram& program() const;
+    // the same program, to run on another ghost
+    shared_ptr<const GhcProgram> sharedProgram() const;
+    // PC, A-H
+    const uint8_t* registers() const;
+    const uint8_t* data() const;
+    // Puts the VM back as a checkpoint found it
+    void restore(const uint8_t* registers, const uint8_t* data);
+    // null unless profiling is enabled
+    const GhcProfile* profile() const;
+    // null unless the memo is enabled
+    const GhcMemo* memo() const;
 
 private:
-    void run(const Game& game);
+    void interpret(const Game& game, int fuel);
+    template<bool Checked, class Profiler>
+    void execute(const Game& game, int fuel);
+    void runNative(const Game& game);
+    void runDifferential(const Game& game);
+    bool replay(const Game& game);
     void handleInterrupt(const Game& game, int num);
-    uint8_t load(GhcArgument arg) const;
-    void store(GhcArgument arg, uint8_t value);
+    void observe(const Game& game, int num);
+    void read(const Game& game, GhcObservation& observation) const;
+
+    friend struct GhcOps;
+    friend class GhcLockstep;
 
     int _ghostNum;
-    Position _startPosition;
-    Position _position;
+    // the direction chosen so far in this move
     Direction _direction;
-    bool _invisible;
 
-    vector<uint8_t> _registers;
-    vector<uint8_t> _data;    
-    vector<GhcInstruction> _code;
+    uint8_t _registers[9]; // PC, A-H
+    uint8_t _data[GHC_DATA_SIZE];
+    shared_ptr<const GhcProgram> _program;
+    GhcEngine _engine;
+    GhcNativeEntry _native;
+    shared_ptr<GhcProfile> _profile;
+    shared_ptr<GhcMemo> _memo;
+    GhcTraceBuffer* _trace;
+    bool _silent;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "ghostpool.hpp"
+#include "game.hpp"
+#include "lockstep.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+GhostPool::GhostPool() :
+    _size(0)
+{
+}
+
+void GhostPool::clear()
+{
+    // drop the programs
+    for(auto i = 0; i < _size; i++)
+    {
+        _ghosts[i] = Ghost();
+    }
+
+    _size = 0;
+}
+
+void GhostPool::assignShadows(const GhostPool& other)
+{
+    for(auto i = other._size; i < _size; i++)
+    {
+        _ghosts[i] = Ghost();
+    }
+
+    _size = other._size;
+
+    copy_n(other._positions, _size, _positions);
+    copy_n(other._startPositions, _size, _startPositions);
+    copy_n(other._directions, _size, _directions);
+    copy_n(other._invisible, _size, _invisible);
+    copy_n(other._decisions, _size, _decisions);
+
+    for(auto i = 0; i < _size; i++)
+    {
+        _ghosts[i] = other._ghosts[i].shadow();
+    }
+}
+
+int GhostPool::add(Position pos, shared_ptr<const GhcProgram> program, GhcEngine engine)
+{
+    if(_size == MAX_GHOSTS)
+    {
+        throw runtime_error("too many ghosts");
+    }
+
+    auto ghostNum = _size++;
+
+    _positions[ghostNum] = pos;
+    _startPositions[ghostNum] = pos;
+    _directions[ghostNum] = Direction::DOWN;
+    _invisible[ghostNum] = false;
+    _ghosts[ghostNum].init(ghostNum, program, engine);
+
+    return ghostNum;
+}
+
+void GhostPool::step(int ghostNum, const Game& game)
+{
+    run(ghostNum, game);
+    move(ghostNum, game);
+}
+
+void GhostPool::run(int ghostNum, const Game& game)
+{
+    _decisions[ghostNum] = _ghosts[ghostNum].run(game, _directions[ghostNum]);
+}
+
+void GhostPool::runLockstep(const int* ghostNums, int count, const Game& game, exception_ptr* errors)
+{
+    GhcLockstep lockstep(_ghosts[ghostNums[0]].program());
+
+    for(auto i = 0; i < count; i++)
+    {
+        lockstep.add(_ghosts[ghostNums[i]], _directions[ghostNums[i]]);
+    }
+
+    lockstep.run(game);
+
+    for(auto i = 0; i < count; i++)
+    {
+        _decisions[ghostNums[i]] = lockstep.decision(i);
+
+        if(lockstep.failed())
+        {
+            errors[i] = lockstep.error(i);
+        }
+    }
+}
+
+void GhostPool::move(int ghostNum, const Game& game)
+{
+    auto& position = _positions[ghostNum];
+    auto& direction = _directions[ghostNum];
+
+    direction = _decisions[ghostNum];
+
+    Direction directions[] =
+    {
+        direction,
+        Direction::UP,
+        Direction::RIGHT,
+        Direction::DOWN,
+        Direction::LEFT
+    };
+
+    for(auto i = 0u; i < sizeof(directions)/sizeof(directions[0]); i++)
+    {
+        auto newPos = position.move(directions[i]);
+
+        if(game.map().get(newPos) != '#')
+        {
+            direction = directions[i];
+            position = newPos;
+            break;
+        }
+    }
+}
+
+void GhostPool::moveAs(int ghostNum, Direction direction, const Game& game)
+{
+    _decisions[ghostNum] = direction;
+    move(ghostNum, game);
+}
+
+void GhostPool::reset(int ghostNum)
+{
+    _positions[ghostNum] = _startPositions[ghostNum];
+}
+
+void GhostPool::place(int ghostNum, Position pos, Direction direction)
+{
+    _positions[ghostNum] = pos;
+    _directions[ghostNum] = direction;
+}
+
+void GhostPool::setInvisible(int ghostNum, bool newInvisible)
+{
+    _invisible[ghostNum] = newInvisible;
+}
+
+void GhostPool::setAllInvisible(bool newInvisible)
+{
+    fill(_invisible, _invisible + _size, newInvisible);
+}
+
+int GhostPool::size() const
+{
+    return _size;
+}
+
+Position GhostPool::position(int ghostNum) const
+{
+    return _positions[ghostNum];
+}
+
+Position GhostPool::startPosition(int ghostNum) const
+{
+    return _startPositions[ghostNum];
+}
+
+Direction GhostPool::direction(int ghostNum) const
+{
+    return _directions[ghostNum];
+}
+
+bool GhostPool::invisible(int ghostNum) const
+{
+    return _invisible[ghostNum];
+}
+
+Direction GhostPool::decision(int ghostNum) const
+{
+    return _decisions[ghostNum];
+}
+
+Ghost& GhostPool::ghost(int ghostNum)
+{
+    return _ghosts[ghostNum];
+}
+
+const Ghost& GhostPool::ghost(int ghostNum) const
+{
+    return _ghosts[ghostNum];
+}
@@ -0,0 +1,69 @@
+#ifndef LAMCO_GHOSTPOOL_HPP
+#define LAMCO_GHOSTPOOL_HPP
+
+#include "basic.hpp"
+#include "ghost.hpp"
+#include <exception>
+#include <memory>
+
+using namespace std;
+
+// Every ghost of a game. What the game loop scans (positions, directions,
+// invisibility) is kept in dense parallel arrays; the VMs sit in one
+// inline array, so nothing is allocated per ghost.
+class GhostPool
+{
+public:
+    // the most Map::validate allows
+    static const int MAX_GHOSTS = 256;
+
+    GhostPool();
+
+    void clear();
+    // Becomes a copy of other's ghosts, their VMs as Ghost::shadow()s.
+    // Only the ghosts in use are copied.
+    void assignShadows(const GhostPool& other);
+    // Returns the new ghost's number
+    int add(Position pos, shared_ptr<const GhcProgram> program,
+        GhcEngine engine = GhcEngine::INTERPRETER);
+
+    // Runs the ghost's program and moves it
+    void step(int ghostNum, const Game& game);
+    // step() in two halves. run() only touches the ghost's own VM and
+    // decision, so different ghosts may run concurrently.
+    void run(int ghostNum, const Game& game);
+    void move(int ghostNum, const Game& game);
+    // move() as if the ghost's program had chosen direction
+    void moveAs(int ghostNum, Direction direction, const Game& game);
+    // run() for up to GHC_LANES ghosts sharing a program, interpreted in
+    // lockstep. errors[i] receives what stopped ghostNums[i], if anything.
+    void runLockstep(const int* ghostNums, int count, const Game& game, exception_ptr* errors);
+    // Sends the ghost back to where it started
+    void reset(int ghostNum);
+    // Puts the ghost where a checkpoint found it
+    void place(int ghostNum, Position pos, Direction direction);
+    void setInvisible(int ghostNum, bool newInvisible);
+    void setAllInvisible(bool newInvisible);
+
+    int size() const;
+    Position position(int ghostNum) const;
+    Position startPosition(int ghostNum) const;
+    Direction direction(int ghostNum) const;
+    bool invisible(int ghostNum) const;
+    // direction chosen by the last run()
+    Direction decision(int ghostNum) const;
+
+    Ghost& ghost(int ghostNum);
+    const Ghost& ghost(int ghostNum) const;
+
+private:
+    int _size;
+    Position _positions[MAX_GHOSTS];
+    Position _startPositions[MAX_GHOSTS];
+    Direction _directions[MAX_GHOSTS];
+    bool _invisible[MAX_GHOSTS];
+    Direction _decisions[MAX_GHOSTS];
+    Ghost _ghosts[MAX_GHOSTS];
+};
+
+#endif
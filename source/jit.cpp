@@ -0,0 +1,607 @@
+#include "jit.hpp"
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define LAMCO_JIT_AVAILABLE
+#endif
+
+#ifdef LAMCO_JIT_AVAILABLE
+
+// Host registers used by generated code:
+//   rbx  GhcNativeContext*
+//   r12  ghost registers
+//   r13  ghost data memory
+//   r14d remaining fuel
+//   r15  jump table, indexed by PC
+//   eax, ecx, edx scratch
+static const uint8_t AL = 0;
+static const uint8_t CL = 1;
+
+class Assembler
+{
+public:
+    int newLabel()
+    {
+        _labels.push_back(-1);
+        return _labels.size() - 1;
+    }
+
+    void bind(int label)
+    {
+        _labels[label] = _bytes.size();
+    }
+
+    void emit(initializer_list<uint8_t> bytes)
+    {
+        _bytes.insert(_bytes.end(), bytes.begin(), bytes.end());
+    }
+
+    void emit32(uint32_t value)
+    {
+        for(auto i = 0; i < 4; i++)
+        {
+            _bytes.push_back((value >> (i * 8)) & 0xFF);
+        }
+    }
+
+    // rel32 to a label, patched by finish()
+    void emitRel(int label)
+    {
+        _fixups.push_back({(int)_bytes.size(), label});
+        emit32(0);
+    }
+
+    void jmp(int label)
+    {
+        emit({0xE9});
+        emitRel(label);
+    }
+
+    // condition is the low nibble of the 0F 8x opcode
+    void jcc(uint8_t condition, int label)
+    {
+        emit({0x0F, (uint8_t)(0x80 | condition)});
+        emitRel(label);
+    }
+
+    // 8-byte table slot holding a label's offset, relocated by finish()
+    void emitAddress(int label)
+    {
+        _relocations.push_back({(int)_bytes.size(), label});
+
+        for(auto i = 0; i < 8; i++)
+        {
+            _bytes.push_back(0);
+        }
+    }
+
+    int size() const
+    {
+        return _bytes.size();
+    }
+
+    void finish(uint8_t* dest) const
+    {
+        memcpy(dest, _bytes.data(), _bytes.size());
+
+        for(auto& fixup : _fixups)
+        {
+            auto rel = (int32_t)(_labels[fixup.second] - (fixup.first + 4));
+            memcpy(dest + fixup.first, &rel, sizeof(rel));
+        }
+
+        for(auto& relocation : _relocations)
+        {
+            auto addr = (uint64_t)(uintptr_t)(dest + _labels[relocation.second]);
+            memcpy(dest + relocation.first, &addr, sizeof(addr));
+        }
+    }
+
+private:
+    vector<uint8_t> _bytes;
+    vector<int> _labels;
+    vector<pair<int, int>> _fixups;
+    vector<pair<int, int>> _relocations;
+};
+
+static const uint8_t COND_B = 0x2;
+static const uint8_t COND_E = 0x4;
+static const uint8_t COND_NE = 0x5;
+static const uint8_t COND_A = 0x7;
+
+enum : int
+{
+    EXIT_HALTED = (int)GhcNativeStatus::HALTED,
+    EXIT_CONTINUE = (int)GhcNativeStatus::CONTINUE,
+    EXIT_FAILED = (int)GhcNativeStatus::FAILED
+};
+
+struct Exit
+{
+    int label;
+    int pc;
+    int refund;
+    int status;
+};
+
+class Compiler
+{
+public:
+    Compiler(const vector<GhcInstruction>& code) :
+        _code(code),
+        _size(code.size())
+    {
+    }
+
+    void compile()
+    {
+        findBlocks();
+
+        _epilogue = _as.newLabel();
+        _table = _as.newLabel();
+        _outOfRange = _as.newLabel();
+        _failed = _as.newLabel();
+
+        for(auto i = 0; i < _size; i++)
+        {
+            _stubs.push_back(_as.newLabel());
+            _bodies.push_back(_as.newLabel());
+        }
+
+        // prologue
+        _as.emit({0x53});                            // push rbx
+        _as.emit({0x41, 0x54});                      // push r12
+        _as.emit({0x41, 0x55});                      // push r13
+        _as.emit({0x41, 0x56});                      // push r14
+        _as.emit({0x41, 0x57});                      // push r15
+        _as.emit({0x48, 0x89, 0xFB});                // mov rbx, rdi
+        _as.emit({0x4C, 0x8B, 0x63, (uint8_t)offsetof(GhcNativeContext, registers)});
+        _as.emit({0x4C, 0x8B, 0x6B, (uint8_t)offsetof(GhcNativeContext, data)});
+        _as.emit({0x44, 0x8B, 0x73, (uint8_t)offsetof(GhcNativeContext, fuel)});
+        _as.emit({0x4C, 0x8D, 0x3D});                // lea r15, [rip + table]
+        _as.emitRel(_table);
+        _as.emit({0x41, 0x0F, 0xB6, 0x04, 0x24});    // movzx eax, byte [r12]
+        _as.emit({0x41, 0xFF, 0x24, 0xC7});          // jmp [r15 + rax*8]
+
+        for(auto i = 0; i < _size; i++)
+        {
+            if(_leaders[i])
+            {
+                _as.bind(_stubs[i]);
+                chargeFuel(i);
+            }
+
+            _as.bind(_bodies[i]);
+            compileInstruction(i);
+        }
+
+        // entry points into the middle of a block, for computed jumps
+        for(auto i = 0; i < _size; i++)
+        {
+            if(!_leaders[i])
+            {
+                _as.bind(_stubs[i]);
+                chargeFuel(i);
+                _as.jmp(_bodies[i]);
+            }
+        }
+
+        for(auto& exit : _exits)
+        {
+            _as.bind(exit.label);
+
+            if(exit.pc >= 0)
+            {
+                _as.emit({0x41, 0xC6, 0x04, 0x24, (uint8_t)exit.pc}); // mov byte [r12], pc
+            }
+
+            if(exit.refund > 0)
+            {
+                _as.emit({0x41, 0x81, 0xC6});        // add r14d, refund
+                _as.emit32(exit.refund);
+            }
+
+            _as.emit({0xB8});                        // mov eax, status
+            _as.emit32(exit.status);
+            _as.jmp(_epilogue);
+        }
+
+        // PC was already written by the computed jump
+        _as.bind(_outOfRange);
+        _as.emit({0xB8});
+        _as.emit32(EXIT_CONTINUE);
+        _as.jmp(_epilogue);
+
+        _as.bind(_failed);
+        _as.emit({0xB8});
+        _as.emit32(EXIT_FAILED);
+
+        _as.bind(_epilogue);
+        _as.emit({0x44, 0x89, 0x73, (uint8_t)offsetof(GhcNativeContext, fuel)});
+        _as.emit({0x41, 0x5F});                      // pop r15
+        _as.emit({0x41, 0x5E});                      // pop r14
+        _as.emit({0x41, 0x5D});                      // pop r13
+        _as.emit({0x41, 0x5C});                      // pop r12
+        _as.emit({0x5B});                            // pop rbx
+        _as.emit({0xC3});                            // ret
+
+        while(_as.size() % 8 != 0)
+        {
+            _as.emit({0xCC});
+        }
+
+        _as.bind(_table);
+
+        for(auto pc = 0; pc < 256; pc++)
+        {
+            _as.emitAddress(pc < _size ? _stubs[pc] : _outOfRange);
+        }
+    }
+
+    const Assembler& assembler() const
+    {
+        return _as;
+    }
+
+private:
+    static bool isJump(GhcOpcode opcode)
+    {
+        return opcode == GhcOpcode::JLT || opcode == GhcOpcode::JEQ || opcode == GhcOpcode::JGT;
+    }
+
+    // Mirrors the fault handlers chosen by the interpreter's decoder
+    static bool isBadStore(const GhcInstruction& instr)
+    {
+        if(isJump(instr.opcode) || instr.opcode == GhcOpcode::INT || instr.opcode == GhcOpcode::HLT)
+        {
+            return false;
+        }
+
+        if(instr.arg1.isRegister && instr.arg1.value == 0)
+        {
+            return true;
+        }
+
+        return instr.arg1.mode() == GhcMode::CONSTANT;
+    }
+
+    // A block runs straight through once its fuel has been charged; it
+    // ends at a jump, a HLT or a faulting store
+    void findBlocks()
+    {
+        _leaders.assign(_size, false);
+        _remaining.assign(_size, 0);
+
+        if(_size > 0)
+        {
+            _leaders[0] = true;
+        }
+
+        for(auto i = 0; i < _size; i++)
+        {
+            auto& instr = _code[i];
+            auto endsBlock = isJump(instr.opcode) || instr.opcode == GhcOpcode::HLT || isBadStore(instr);
+
+            if(endsBlock && i + 1 < _size)
+            {
+                _leaders[i + 1] = true;
+            }
+
+            if(isJump(instr.opcode) && instr.arg1.mode() == GhcMode::CONSTANT && instr.arg1.value < _size)
+            {
+                _leaders[instr.arg1.value] = true;
+            }
+        }
+
+        // fuel charged on entry at i covers i up to the end of its block;
+        // a HLT finishes the step without being counted
+        for(auto i = _size - 1; i >= 0; i--)
+        {
+            auto cost = _code[i].opcode == GhcOpcode::HLT ? 0 : 1;
+            auto blockEnds = (i + 1 == _size) || _leaders[i + 1];
+            _remaining[i] = cost + (blockEnds ? 0 : _remaining[i + 1]);
+        }
+    }
+
+    void chargeFuel(int pc)
+    {
+        if(_remaining[pc] == 0)
+        {
+            return;
+        }
+
+        _as.emit({0x41, 0x81, 0xFE});                // cmp r14d, remaining
+        _as.emit32(_remaining[pc]);
+        _as.jcc(COND_B, exitLabel(pc, 0, EXIT_CONTINUE));
+        _as.emit({0x41, 0x81, 0xEE});                // sub r14d, remaining
+        _as.emit32(_remaining[pc]);
+    }
+
+    int exitLabel(int pc, int refund, int status)
+    {
+        auto label = _as.newLabel();
+        _exits.push_back({label, pc, refund, status});
+        return label;
+    }
+
+    // Leaves native code before instruction pc so the interpreter repeats it
+    int bailLabel(int pc)
+    {
+        return exitLabel(pc, _remaining[pc], EXIT_CONTINUE);
+    }
+
+    // Reading PC yields the address of the executing instruction
+    static GhcArgument resolvePc(GhcArgument arg, int pc)
+    {
+        if(arg.isRegister && arg.value == 0)
+        {
+            arg.isRegister = false;
+            arg.value = pc;
+        }
+
+        return arg;
+    }
+
+    void load(uint8_t reg, GhcArgument arg, int pc)
+    {
+        arg = resolvePc(arg, pc);
+
+        switch(arg.mode())
+        {
+            case GhcMode::CONSTANT:
+                _as.emit({(uint8_t)(0xB0 + reg), arg.value});                          // mov reg8, imm8
+                break;
+            case GhcMode::REGISTER:
+                _as.emit({0x41, 0x8A, (uint8_t)(0x44 | reg << 3), 0x24, arg.value});   // mov reg8, [r12 + r]
+                break;
+            case GhcMode::INDIRECT_CONSTANT:
+                _as.emit({0x41, 0x8A, (uint8_t)(0x85 | reg << 3)});                    // mov reg8, [r13 + addr]
+                _as.emit32(arg.value);
+                break;
+            case GhcMode::INDIRECT_REGISTER:
+                _as.emit({0x41, 0x0F, 0xB6, (uint8_t)(0x44 | reg << 3), 0x24, arg.value}); // movzx reg32, [r12 + r]
+                _as.emit({0x41, 0x8A, (uint8_t)(0x44 | reg << 3), (uint8_t)(0x05 | reg << 3), 0x00}); // mov reg8, [r13 + reg64]
+                break;
+        }
+    }
+
+    // Stores al; targets were checked by isBadStore()
+    void store(GhcArgument arg)
+    {
+        switch(arg.mode())
+        {
+            case GhcMode::REGISTER:
+                _as.emit({0x41, 0x88, 0x44, 0x24, arg.value});                         // mov [r12 + r], al
+                break;
+            case GhcMode::INDIRECT_CONSTANT:
+                _as.emit({0x41, 0x88, 0x85});                                          // mov [r13 + addr], al
+                _as.emit32(arg.value);
+                break;
+            case GhcMode::INDIRECT_REGISTER:
+                _as.emit({0x41, 0x0F, 0xB6, 0x54, 0x24, arg.value});                   // movzx edx, [r12 + r]
+                _as.emit({0x41, 0x88, 0x44, 0x15, 0x00});                              // mov [r13 + rdx], al
+                break;
+            case GhcMode::CONSTANT:
+                break;
+        }
+    }
+
+    void fallThrough(int pc)
+    {
+        auto nextPc = (pc + 1) & 0xFF;
+
+        if(pc + 1 < _size)
+        {
+            // the next body or leader stub follows directly
+            return;
+        }
+
+        if(nextPc < _size)
+        {
+            _as.jmp(_stubs[nextPc]);
+        }
+        else
+        {
+            _as.jmp(exitLabel(nextPc, 0, EXIT_CONTINUE));
+        }
+    }
+
+    void compileJump(int pc, uint8_t condition)
+    {
+        auto& instr = _code[pc];
+
+        load(AL, instr.arg2, pc);
+        load(CL, instr.arg3, pc);
+        _as.emit({0x38, 0xC8});                      // cmp al, cl
+
+        auto target = resolvePc(instr.arg1, pc);
+
+        if(target.mode() == GhcMode::CONSTANT)
+        {
+            _as.jcc(condition, target.value < _size ? _stubs[target.value] : exitLabel(target.value, 0, EXIT_CONTINUE));
+        }
+        else
+        {
+            auto notTaken = _as.newLabel();
+            _as.jcc(condition ^ 1, notTaken);
+            load(AL, target, pc);
+            _as.emit({0x0F, 0xB6, 0xC0});            // movzx eax, al
+            _as.emit({0x41, 0x88, 0x04, 0x24});      // mov [r12], al
+            _as.emit({0x41, 0xFF, 0x24, 0xC7});      // jmp [r15 + rax*8]
+            _as.bind(notTaken);
+        }
+
+        fallThrough(pc);
+    }
+
+    void compileArithmetic(int pc, bool hasSource, initializer_list<uint8_t> op)
+    {
+        auto& instr = _code[pc];
+
+        load(AL, instr.arg1, pc);
+
+        if(hasSource)
+        {
+            load(CL, instr.arg2, pc);
+        }
+
+        _as.emit(op);
+        store(instr.arg1);
+        fallThrough(pc);
+    }
+
+    void compileInstruction(int pc)
+    {
+        auto& instr = _code[pc];
+
+        if(isBadStore(instr))
+        {
+            _as.jmp(bailLabel(pc));
+            return;
+        }
+
+        switch(instr.opcode)
+        {
+            case GhcOpcode::MOV:
+                load(AL, instr.arg2, pc);
+                store(instr.arg1);
+                fallThrough(pc);
+                break;
+            case GhcOpcode::INC:
+                compileArithmetic(pc, false, {0xFE, 0xC0});     // inc al
+                break;
+            case GhcOpcode::DEC:
+                compileArithmetic(pc, false, {0xFE, 0xC8});     // dec al
+                break;
+            case GhcOpcode::ADD:
+                compileArithmetic(pc, true, {0x00, 0xC8});     // add al, cl
+                break;
+            case GhcOpcode::SUB:
+                compileArithmetic(pc, true, {0x28, 0xC8});     // sub al, cl
+                break;
+            case GhcOpcode::MUL:
+                compileArithmetic(pc, true, {0xF6, 0xE1});     // mul cl
+                break;
+            case GhcOpcode::DIV:
+                load(AL, instr.arg1, pc);
+                load(CL, instr.arg2, pc);
+                _as.emit({0x84, 0xC9});              // test cl, cl
+                _as.jcc(COND_E, bailLabel(pc));
+                _as.emit({0x0F, 0xB6, 0xC0});        // movzx eax, al
+                _as.emit({0xF6, 0xF1});              // div cl
+                store(instr.arg1);
+                fallThrough(pc);
+                break;
+            case GhcOpcode::AND:
+                compileArithmetic(pc, true, {0x20, 0xC8});     // and al, cl
+                break;
+            case GhcOpcode::OR:
+                compileArithmetic(pc, true, {0x08, 0xC8});     // or al, cl
+                break;
+            case GhcOpcode::XOR:
+                compileArithmetic(pc, true, {0x30, 0xC8});     // xor al, cl
+                break;
+            case GhcOpcode::JLT:
+                compileJump(pc, COND_B);
+                break;
+            case GhcOpcode::JEQ:
+                compileJump(pc, COND_E);
+                break;
+            case GhcOpcode::JGT:
+                compileJump(pc, COND_A);
+                break;
+            case GhcOpcode::INT:
+                load(AL, instr.arg1, pc);
+                _as.emit({0x41, 0xC6, 0x04, 0x24, (uint8_t)pc}); // mov byte [r12], pc
+                _as.emit({0x48, 0x89, 0xDF});        // mov rdi, rbx
+                _as.emit({0x0F, 0xB6, 0xF0});        // movzx esi, al
+                _as.emit({0xFF, 0x53, (uint8_t)offsetof(GhcNativeContext, interrupt)}); // call [rbx + interrupt]
+                _as.emit({0x85, 0xC0});              // test eax, eax
+                _as.jcc(COND_NE, _failed);
+                fallThrough(pc);
+                break;
+            case GhcOpcode::HLT:
+                _as.jmp(exitLabel(pc, 0, EXIT_HALTED));
+                break;
+        }
+    }
+
+    const vector<GhcInstruction>& _code;
+    int _size;
+    Assembler _as;
+    vector<bool> _leaders;
+    vector<int> _remaining;
+    vector<int> _stubs;
+    vector<int> _bodies;
+    vector<Exit> _exits;
+    int _epilogue;
+    int _table;
+    int _outOfRange;
+    int _failed;
+};
+
+shared_ptr<const GhcJit> GhcJit::compile(const vector<GhcInstruction>& code)
+{
+    if(code.empty() || code.size() > 256)
+    {
+        return nullptr;
+    }
+
+    Compiler compiler(code);
+    compiler.compile();
+
+    auto& as = compiler.assembler();
+    auto size = (size_t)as.size();
+    auto buffer = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(buffer == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    as.finish((uint8_t*)buffer);
+
+    if(mprotect(buffer, size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(buffer, size);
+        return nullptr;
+    }
+
+    auto jit = shared_ptr<GhcJit>(new GhcJit());
+    jit->_buffer = buffer;
+    jit->_size = size;
+    jit->_entry = reinterpret_cast<GhcNativeEntry>(buffer);
+    return jit;
+}
+
+GhcJit::~GhcJit()
+{
+    munmap(_buffer, _size);
+}
+
+#else
+
+shared_ptr<const GhcJit> GhcJit::compile(const vector<GhcInstruction>&)
+{
+    return nullptr;
+}
+
+GhcJit::~GhcJit()
+{
+}
+
+#endif
+
+GhcJit::GhcJit() :
+    _buffer(nullptr),
+    _size(0),
+    _entry(nullptr)
+{
+}
+
+GhcNativeEntry GhcJit::entry() const
+{
+    return _entry;
+}
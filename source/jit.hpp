@@ -0,0 +1,32 @@
+#ifndef LAMCO_JIT_HPP
+#define LAMCO_JIT_HPP
+
+#include "ghost.hpp"
+#include "native.hpp"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// x86-64 native code for one ghost program
+class GhcJit
+{
+public:
+    // Returns null when native code generation isn't available
+    static shared_ptr<const GhcJit> compile(const vector<GhcInstruction>& code);
+
+    ~GhcJit();
+
+    GhcNativeEntry entry() const;
+
+private:
+    GhcJit();
+    GhcJit(const GhcJit&);
+    GhcJit& operator=(const GhcJit&);
+
+    void* _buffer;
+    size_t _size;
+    GhcNativeEntry _entry;
+};
+
+#endif
@@ -0,0 +1,248 @@
+#include "shard.hpp"
+#include "tournament.hpp"
+#include <chrono>
+#include <fstream>
+#include <getopt.h>
+
+static const option long_options[] =
+{
+    {"map", required_argument, nullptr, 'm'},
+    {"player", required_argument, nullptr, 'p'},
+    {"ghosts", required_argument, nullptr, 'g'},
+    {"engine", required_argument, nullptr, 'e'},
+    {"threads", required_argument, nullptr, 'j'},
+    {"output", required_argument, nullptr, 'o'},
+    {"format", required_argument, nullptr, 'f'},
+    {"serve", required_argument, nullptr, 'S'},
+    {"workers", required_argument, nullptr, 'w'},
+    {"shard-size", required_argument, nullptr, 'n'},
+    {"retries", required_argument, nullptr, 'r'},
+    {"worker-timeout", required_argument, nullptr, 't'},
+    {nullptr, 0, nullptr, '\0'}
+};
+
+static GhcEngine parseEngine(const string& str)
+{
+    if(str == "interpreter") { return GhcEngine::INTERPRETER; }
+    else if(str == "jit") { return GhcEngine::JIT; }
+    else if(str == "differential") { return GhcEngine::DIFFERENTIAL; }
+
+    throw runtime_error("--engine, -e must be interpreter, jit or differential");
+}
+
+// A ghost set is its program paths separated by commas, and so is a
+// list of workers
+static vector<string> splitPaths(const string& str)
+{
+    vector<string> paths;
+    auto start = size_t {0};
+
+    while(true)
+    {
+        auto end = str.find(',', start);
+        paths.push_back(str.substr(start, end - start));
+
+        if(end == string::npos)
+        {
+            break;
+        }
+
+        start = end + 1;
+    }
+
+    for(auto& path : paths)
+    {
+        if(path.empty())
+        {
+            throw runtime_error("empty path in " + str);
+        }
+    }
+
+    return paths;
+}
+
+// Plays every map against every player and ghost set, one game per core,
+// or on other lamco-tournament processes serving shards of the games
+int main(int argc, char* argv[])
+{
+    try
+    {
+        vector<string> mapPaths;
+        vector<string> playerPaths;
+        vector<vector<string>> ghostSets;
+        auto ghostEngine = GhcEngine::INTERPRETER;
+        auto threads = (int)thread::hardware_concurrency();
+        string outputPath;
+        string format = "csv";
+        auto servePort = -1;
+        vector<string> workers;
+        auto shardSize = 0;
+        auto retries = 3;
+        auto workerTimeout = 60;
+
+        while(true)
+        {
+            int index;
+            auto opt = getopt_long(argc, argv, "m:p:g:e:j:o:f:S:w:n:r:t:", long_options, &index);
+
+            if(opt < 0)
+            {
+                break;
+            }
+
+            switch(opt)
+            {
+                case 'm':
+                    mapPaths.push_back(optarg);
+                    break;
+                case 'p':
+                    playerPaths.push_back(optarg);
+                    break;
+                case 'g':
+                    ghostSets.push_back(splitPaths(optarg));
+                    break;
+                case 'e':
+                    ghostEngine = parseEngine(optarg);
+                    break;
+                case 'j':
+                    threads = atoi(optarg);
+
+                    if(threads < 1)
+                    {
+                        throw runtime_error("--threads, -j must be at least 1");
+                    }
+                    break;
+                case 'o':
+                    outputPath = optarg;
+                    break;
+                case 'f':
+                    format = optarg;
+                    break;
+                case 'S':
+                    servePort = atoi(optarg);
+
+                    if(servePort < 0 || servePort > 65535)
+                    {
+                        throw runtime_error("--serve, -S must be a port");
+                    }
+                    break;
+                case 'w':
+                    workers = splitPaths(optarg);
+                    break;
+                case 'n':
+                    shardSize = atoi(optarg);
+
+                    if(shardSize < 1)
+                    {
+                        throw runtime_error("--shard-size, -n must be at least 1");
+                    }
+                    break;
+                case 'r':
+                    retries = atoi(optarg);
+
+                    if(retries < 0)
+                    {
+                        throw runtime_error("--retries, -r must not be negative");
+                    }
+                    break;
+                case 't':
+                    workerTimeout = atoi(optarg);
+
+                    if(workerTimeout < 0)
+                    {
+                        throw runtime_error("--worker-timeout, -t must not be negative");
+                    }
+                    break;
+            }
+        }
+
+        // hardware_concurrency may not know
+        threads = max(threads, 1);
+
+        if(servePort >= 0)
+        {
+            WorkerPool pool(threads);
+            ShardWorker worker(servePort, pool);
+            cerr << "serving on port " << worker.port() << " with " << threads << " threads" << endl;
+            worker.serve();
+        }
+
+        if(mapPaths.empty())
+        {
+            throw runtime_error("--map, -m argument required");
+        }
+
+        if(playerPaths.empty())
+        {
+            throw runtime_error("--player, -p argument required");
+        }
+
+        if(ghostSets.empty())
+        {
+            throw runtime_error("--ghosts, -g argument required");
+        }
+
+        if(format != "csv" && format != "jsonl")
+        {
+            throw runtime_error("--format, -f must be csv or jsonl");
+        }
+
+        ofstream file;
+
+        if(!outputPath.empty())
+        {
+            file.open(outputPath);
+
+            if(!file)
+            {
+                throw runtime_error("bad output stream");
+            }
+        }
+
+        auto& os = outputPath.empty() ? cout : file;
+
+        Tournament tournament(mapPaths, playerPaths, ghostSets, ghostEngine);
+        auto start = chrono::steady_clock::now();
+
+        if(workers.empty())
+        {
+            WorkerPool pool(threads);
+            tournament.run(pool);
+        }
+        else
+        {
+            ShardCoordinator coordinator(workers, shardSize, retries, workerTimeout);
+            tournament.run(coordinator);
+            cerr << coordinator.shards() << " shards on " << workers.size() << " workers, "
+                 << coordinator.resent() << " resent" << endl;
+        }
+
+        auto seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        if(format == "csv")
+        {
+            tournament.writeCsv(os);
+        }
+        else
+        {
+            tournament.writeJsonl(os);
+        }
+
+        auto failed = 0;
+
+        for(auto& result : tournament.results())
+        {
+            failed += result.error.empty() ? 0 : 1;
+        }
+
+        cerr << tournament.jobs().size() << " games in "
+             << seconds << "s, " << failed << " failed" << endl;
+    }
+    catch(const runtime_error& e)
+    {
+        cerr << "An error occurred: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
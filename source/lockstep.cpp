@@ -0,0 +1,611 @@
+#include "lockstep.hpp"
+#include "game.hpp"
+#include <cstring>
+#include <stdexcept>
+
+// below this many ghosts to run, a batch runs them one at a time
+static const int GHC_MIN_LANES = 4;
+
+// GCC vector types: SSE2 or wider where available, plain scalar code
+// elsewhere. A mask lane is 0xFF when set.
+typedef uint8_t GhcLanes __attribute__((vector_size(GHC_LANES)));
+typedef int8_t GhcSignedLanes __attribute__((vector_size(GHC_LANES)));
+typedef int16_t GhcLaneFuel __attribute__((vector_size(GHC_LANES * 2)));
+
+static bool any(GhcLanes mask)
+{
+    uint64_t halves[GHC_LANES / 8];
+    memcpy(halves, &mask, sizeof(halves));
+
+    auto bits = uint64_t {0};
+
+    for(auto half : halves)
+    {
+        bits |= half;
+    }
+
+    return bits != 0;
+}
+
+static GhcLanes blend(GhcLanes mask, GhcLanes a, GhcLanes b)
+{
+    return (a & mask) | (b & ~mask);
+}
+
+static GhcLanes broadcast(uint8_t value)
+{
+    return GhcLanes {} + value;
+}
+
+static uint8_t lowest(GhcLanes lanes)
+{
+    auto value = uint8_t {0xFF};
+
+    for(auto lane = 0; lane < GHC_LANES; lane++)
+    {
+        value = lanes[lane] < value ? lanes[lane] : value;
+    }
+
+    return value;
+}
+
+static int least(const GhcLaneFuel& fuel)
+{
+    auto value = int16_t {GHC_MAX_INSTR_COUNT};
+
+    for(auto lane = 0; lane < GHC_LANES; lane++)
+    {
+        value = fuel[lane] < value ? fuel[lane] : value;
+    }
+
+    return value;
+}
+
+// Register file of every lane while a batch runs, transposed so that a
+// register holds a value per lane. Memory stays with each ghost.
+class GhcLaneMachine
+{
+public:
+    // PC of the lanes running together; registers[0] only catches up when
+    // they stop
+    uint8_t pc;
+    GhcLanes registers[9];
+    uint8_t* data[GHC_LANES];
+
+    GhcLanes reg(uint8_t r) const
+    {
+        return r == 0 ? broadcast(pc) : registers[r];
+    }
+
+    GhcLanes load(GhcArgument arg) const
+    {
+        auto value = GhcLanes {};
+
+        switch(arg.mode())
+        {
+            case GhcMode::REGISTER:
+                return reg(arg.value);
+            case GhcMode::CONSTANT:
+                return broadcast(arg.value);
+            case GhcMode::INDIRECT_REGISTER:
+                {
+                    auto addresses = reg(arg.value);
+
+                    for(auto lane = 0; lane < GHC_LANES; lane++)
+                    {
+                        value[lane] = data[lane][addresses[lane]];
+                    }
+                }
+                break;
+            case GhcMode::INDIRECT_CONSTANT:
+                for(auto lane = 0; lane < GHC_LANES; lane++)
+                {
+                    value[lane] = data[lane][arg.value];
+                }
+                break;
+        }
+
+        return value;
+    }
+
+    // Stores to PC and to constants are rejected before this
+    void store(GhcArgument arg, GhcLanes mask, GhcLanes value)
+    {
+        switch(arg.mode())
+        {
+            case GhcMode::REGISTER:
+                registers[arg.value] = blend(mask, value, registers[arg.value]);
+                break;
+            case GhcMode::CONSTANT:
+                break;
+            case GhcMode::INDIRECT_REGISTER:
+                {
+                    auto addresses = reg(arg.value);
+
+                    for(auto lane = 0; lane < GHC_LANES; lane++)
+                    {
+                        if(mask[lane])
+                        {
+                            data[lane][addresses[lane]] = value[lane];
+                        }
+                    }
+                }
+                break;
+            case GhcMode::INDIRECT_CONSTANT:
+                for(auto lane = 0; lane < GHC_LANES; lane++)
+                {
+                    if(mask[lane])
+                    {
+                        data[lane][arg.value] = value[lane];
+                    }
+                }
+                break;
+        }
+    }
+};
+
+GhcLockstep::GhcLockstep(const GhcProgram& program) :
+    _program(program),
+    _size(0)
+{
+}
+
+bool GhcLockstep::eligible(const Ghost& ghost)
+{
+    return !ghost._native && !ghost._profile && !ghost._memo;
+}
+
+void GhcLockstep::add(Ghost& ghost, Direction direction)
+{
+    if(_size == GHC_LANES)
+    {
+        throw logic_error("lockstep batch is full");
+    }
+
+    ghost._direction = direction;
+    _ghosts[_size] = &ghost;
+    _size++;
+}
+
+int GhcLockstep::size() const
+{
+    return _size;
+}
+
+Direction GhcLockstep::decision(int lane) const
+{
+    return _ghosts[lane]->_direction;
+}
+
+bool GhcLockstep::failed() const
+{
+    return !_errors.empty();
+}
+
+exception_ptr GhcLockstep::error(int lane) const
+{
+    return _errors.empty() ? nullptr : _errors[lane];
+}
+
+// Lanes never affect each other, so any order of running them gives the
+// same result. The lanes at the lowest PC run together until they split
+// up, stop, or reach a PC where others wait, which gives lanes that split
+// the best chance to join up again.
+void GhcLockstep::run(const Game& game)
+{
+    auto& code = _program.code();
+    auto size = code.size();
+    // verified programs keep PC in range and store nowhere they shouldn't
+    auto checked = !_program.verified();
+    _errors.clear();
+
+    // A ghost whose PC is on an HLT halts at once, changing nothing, so it
+    // needs no lane. Too few ghosts left don't pay for moving them into
+    // lanes and back; they run one at a time as Ghost::run would.
+    uint8_t running[GHC_LANES] = {};
+    auto count = 0;
+
+    for(auto lane = 0; lane < _size; lane++)
+    {
+        auto pc = _ghosts[lane]->_registers[0];
+
+        if(pc >= size || code[pc].opcode != GhcOpcode::HLT)
+        {
+            running[lane] = 0xFF;
+            count++;
+        }
+    }
+
+    if(count < GHC_MIN_LANES)
+    {
+        for(auto lane = 0; lane < _size; lane++)
+        {
+            try
+            {
+                if(running[lane])
+                {
+                    _ghosts[lane]->interpret(game, GHC_MAX_INSTR_COUNT);
+                }
+            }
+            catch(...)
+            {
+                _errors.resize(_size);
+                _errors[lane] = current_exception();
+            }
+        }
+
+        return;
+    }
+
+    GhcLaneMachine machine;
+    auto active = GhcLanes {};
+    auto fuel = GhcLaneFuel {} + GHC_MAX_INSTR_COUNT;
+    auto& pcs = machine.registers[0];
+    static uint8_t spare[GHC_DATA_SIZE];
+
+    // gathered a register at a time, as writing single lanes of a vector
+    // stalls reading it back whole
+    uint8_t lanes[9][GHC_LANES] = {};
+
+    for(auto lane = 0; lane < _size; lane++)
+    {
+        for(auto r = 0; r < 9; r++)
+        {
+            lanes[r][lane] = _ghosts[lane]->_registers[r];
+        }
+    }
+
+    memcpy(machine.registers, lanes, sizeof(lanes));
+    memcpy(&active, running, sizeof(active));
+
+    uint8_t indices[GHC_LANES] = {};
+
+    for(auto lane = 0; lane < _size; lane++)
+    {
+        indices[lane] = (uint8_t)_ghosts[lane]->_ghostNum;
+    }
+
+    auto ghostNums = GhcLanes {};
+    memcpy(&ghostNums, indices, sizeof(ghostNums));
+
+    for(auto lane = 0; lane < GHC_LANES; lane++)
+    {
+        // empty lanes read a shared spare block and never store to it
+        machine.data[lane] = lane < _size ? _ghosts[lane]->_data : spare;
+    }
+
+    // stops the lanes in mask at the current PC with the current exception
+    auto fail = [&](GhcLanes mask)
+    {
+        _errors.resize(_size);
+
+        for(auto lane = 0; lane < _size; lane++)
+        {
+            if(mask[lane])
+            {
+                _errors[lane] = current_exception();
+            }
+        }
+
+        pcs = blend(mask, broadcast(machine.pc), pcs);
+        active &= ~mask;
+    };
+
+    // Serves interrupt num for the lanes in mask as handleInterrupt would,
+    // without taking them out of the lanes. False leaves it to the lanes'
+    // ghosts, as for the map reads of int 7 and the dump of int 8.
+    auto serveAll = [&](uint8_t num, GhcLanes mask)
+    {
+        auto& a = machine.registers[1];
+        auto& b = machine.registers[2];
+        uint8_t outs[2][GHC_LANES] = {};
+        auto& ghosts = game.ghosts();
+
+        switch(num)
+        {
+            case 0:
+                for(auto lane = 0; lane < _size; lane++)
+                {
+                    if(mask[lane] && a[lane] < 4)
+                    {
+                        _ghosts[lane]->_direction = (Direction)a[lane];
+                    }
+                }
+                return true;
+            case 1:
+                {
+                    auto position = game.player().position();
+                    a = blend(mask, broadcast(position.x), a);
+                    b = blend(mask, broadcast(position.y), b);
+                }
+                return true;
+            case 2:
+                return true;
+            case 3:
+                a = blend(mask, ghostNums, a);
+                return true;
+            case 4:
+            case 5:
+                for(auto lane = 0; lane < _size; lane++)
+                {
+                    if(mask[lane])
+                    {
+                        auto ghostNum = _ghosts[lane]->_ghostNum;
+                        auto position = num == 4 ? ghosts.startPosition(ghostNum) : ghosts.position(ghostNum);
+                        outs[0][lane] = position.x;
+                        outs[1][lane] = position.y;
+                    }
+                }
+                break;
+            case 6:
+                {
+                    auto fright = game.frightMode();
+
+                    for(auto lane = 0; lane < _size; lane++)
+                    {
+                        if(mask[lane])
+                        {
+                            auto ghostNum = _ghosts[lane]->_ghostNum;
+                            outs[0][lane] = (uint8_t)_ghosts[lane]->_direction;
+                            outs[1][lane] = ghosts.invisible(ghostNum) ? 2 : fright ? 1 : 0;
+                        }
+                    }
+                }
+                break;
+            default:
+                return false;
+        }
+
+        auto outA = GhcLanes {};
+        auto outB = GhcLanes {};
+        memcpy(&outA, outs[0], sizeof(outA));
+        memcpy(&outB, outs[1], sizeof(outB));
+        a = blend(mask, outA, a);
+        b = blend(mask, outB, b);
+        return true;
+    };
+
+    while(any(active))
+    {
+        // stopped lanes read as 0xFF
+        auto pc = lowest(pcs | ~active);
+        auto mask = (GhcLanes)(pcs == pc) & active;
+        auto waiting = lowest(pcs | ~(active & ~mask));
+        auto spent = 0;
+
+        // lanes in mask have spent the same fuel ever since they last met
+        auto fuelMask = __builtin_convertvector((GhcSignedLanes)mask, GhcLaneFuel);
+        auto budget = least((fuel & fuelMask) | (GHC_MAX_INSTR_COUNT & ~fuelMask));
+
+        machine.pc = pc;
+
+        try
+        {
+            while(true)
+            {
+                if(checked && pc >= size)
+                {
+                    throw runtime_error("program counter out of range");
+                }
+
+                auto& instr = code[pc];
+                auto nextPc = (uint8_t)(pc + 1);
+                auto split = false;
+
+                if(checked)
+                {
+                    switch(instr.opcode)
+                    {
+                        case GhcOpcode::JLT:
+                        case GhcOpcode::JEQ:
+                        case GhcOpcode::JGT:
+                        case GhcOpcode::INT:
+                        case GhcOpcode::HLT:
+                            break;
+                        default:
+                            if(instr.arg1.isRegister && instr.arg1.value == 0)
+                            {
+                                throw logic_error("cannot store to program counter");
+                            }
+
+                            if(instr.arg1.mode() == GhcMode::CONSTANT)
+                            {
+                                throw logic_error("cannot store to constant");
+                            }
+                            break;
+                    }
+                }
+
+                switch(instr.opcode)
+                {
+                    case GhcOpcode::MOV:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::INC:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) + 1);
+                        break;
+                    case GhcOpcode::DEC:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) - 1);
+                        break;
+                    case GhcOpcode::ADD:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) + machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::SUB:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) - machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::MUL:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) * machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::DIV:
+                        {
+                            // no SIMD byte division; lanes dividing by zero fail alone
+                            auto dividend = machine.load(instr.arg1);
+                            auto divisor = machine.load(instr.arg2);
+                            auto zero = (GhcLanes)(divisor == 0) & mask;
+
+                            if(any(zero))
+                            {
+                                try
+                                {
+                                    throw runtime_error("division by zero");
+                                }
+                                catch(...)
+                                {
+                                    fail(zero);
+                                }
+
+                                mask &= active;
+                            }
+
+                            auto quotient = GhcLanes {};
+
+                            for(auto lane = 0; lane < GHC_LANES; lane++)
+                            {
+                                quotient[lane] = mask[lane] ? dividend[lane] / divisor[lane] : 0;
+                            }
+
+                            machine.store(instr.arg1, mask, quotient);
+                        }
+                        break;
+                    case GhcOpcode::AND:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) & machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::OR:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) | machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::XOR:
+                        machine.store(instr.arg1, mask, machine.load(instr.arg1) ^ machine.load(instr.arg2));
+                        break;
+                    case GhcOpcode::JLT:
+                    case GhcOpcode::JEQ:
+                    case GhcOpcode::JGT:
+                        {
+                            auto lhs = machine.load(instr.arg2);
+                            auto rhs = machine.load(instr.arg3);
+                            auto taken = mask & (GhcLanes)(
+                                instr.opcode == GhcOpcode::JLT ? lhs < rhs :
+                                instr.opcode == GhcOpcode::JEQ ? lhs == rhs : lhs > rhs);
+
+                            if(any(taken))
+                            {
+                                auto next = blend(taken, machine.load(instr.arg1), broadcast(nextPc));
+                                nextPc = lowest(next | ~mask);
+
+                                if(any((GhcLanes)(next != nextPc) & mask))
+                                {
+                                    pcs = blend(mask, next, pcs);
+                                    split = true;
+                                }
+                            }
+                        }
+                        break;
+                    case GhcOpcode::INT:
+                        if(instr.arg1.mode() == GhcMode::CONSTANT && serveAll(instr.arg1.value, mask))
+                        {
+                            break;
+                        }
+
+                        {
+                            // the rest are served one lane at a time by the
+                            // lane's ghost. Interrupts only use A and B, so
+                            // only they go out of the lanes, except for int
+                            // 8, which dumps every register.
+                            uint8_t nums[GHC_LANES];
+                            uint8_t serving[GHC_LANES];
+                            uint8_t ab[2][GHC_LANES];
+                            auto numLanes = machine.load(instr.arg1);
+                            memcpy(nums, &numLanes, sizeof(nums));
+                            memcpy(serving, &mask, sizeof(serving));
+                            memcpy(ab, &machine.registers[1], sizeof(ab));
+                            auto failed = GhcLanes {};
+
+                            for(auto lane = 0; lane < _size; lane++)
+                            {
+                                if(!serving[lane])
+                                {
+                                    continue;
+                                }
+
+                                auto ghost = _ghosts[lane];
+                                ghost->_registers[1] = ab[0][lane];
+                                ghost->_registers[2] = ab[1][lane];
+
+                                if(nums[lane] == 8)
+                                {
+                                    ghost->_registers[0] = pc;
+
+                                    for(auto r = 3; r < 9; r++)
+                                    {
+                                        ghost->_registers[r] = machine.registers[r][lane];
+                                    }
+                                }
+
+                                try
+                                {
+                                    ghost->handleInterrupt(game, nums[lane]);
+                                }
+                                catch(...)
+                                {
+                                    failed[lane] = 0xFF;
+                                    fail(failed);
+                                    failed[lane] = 0;
+                                }
+
+                                ab[0][lane] = ghost->_registers[1];
+                                ab[1][lane] = ghost->_registers[2];
+                            }
+
+                            memcpy(&machine.registers[1], ab, sizeof(ab));
+                            mask &= active;
+                        }
+                        break;
+                    case GhcOpcode::HLT:
+                        // PC stays on the HLT
+                        pcs = blend(mask, broadcast(pc), pcs);
+                        active &= ~mask;
+                        break;
+                }
+
+                if(!any(mask & active))
+                {
+                    break;
+                }
+
+                spent++;
+
+                if(split)
+                {
+                    break;
+                }
+
+                pc = nextPc;
+                machine.pc = pc;
+
+                if(spent == budget || pc >= waiting)
+                {
+                    pcs = blend(mask, broadcast(pc), pcs);
+                    break;
+                }
+            }
+        }
+        catch(...)
+        {
+            // PC stays on the instruction that failed, as in Ghost::run
+            fail(mask);
+        }
+
+        // those out of fuel stop
+        fuel -= fuelMask & (int16_t)spent;
+        active &= ~(GhcLanes)__builtin_convertvector(fuel == 0, GhcSignedLanes);
+    }
+
+    memcpy(lanes, machine.registers, sizeof(lanes));
+
+    for(auto lane = 0; lane < _size; lane++)
+    {
+        for(auto r = 0; r < 9; r++)
+        {
+            _ghosts[lane]->_registers[r] = lanes[r][lane];
+        }
+    }
+}
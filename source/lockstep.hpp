@@ -0,0 +1,41 @@
+#ifndef LAMCO_LOCKSTEP_HPP
+#define LAMCO_LOCKSTEP_HPP
+
+#include "ghost.hpp"
+#include <exception>
+#include <vector>
+
+using namespace std;
+
+static const int GHC_LANES = 16;
+
+// Runs one move of up to GHC_LANES ghosts that share a program, one ghost
+// per SIMD lane. All lanes follow the lowest PC among them; lanes elsewhere
+// wait, so each behaves exactly as Ghost::run would.
+class GhcLockstep
+{
+public:
+    explicit GhcLockstep(const GhcProgram& program);
+
+    // interpreted ghosts without a profile or memo only
+    static bool eligible(const Ghost& ghost);
+
+    void add(Ghost& ghost, Direction direction);
+    int size() const;
+    void run(const Game& game);
+
+    Direction decision(int lane) const;
+    // whether any lane stopped on an error
+    bool failed() const;
+    // what stopped the lane, or null
+    exception_ptr error(int lane) const;
+
+private:
+    const GhcProgram& _program;
+    Ghost* _ghosts[GHC_LANES];
+    // per lane, allocated on the first error
+    vector<exception_ptr> _errors;
+    int _size;
+};
+
+#endif
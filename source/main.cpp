@@ -1,4 +1,7 @@
 #include "game.hpp"
+#include "memo.hpp"
+#include "profile.hpp"
+#include <fstream>
 #include <getopt.h>
 
 static const option long_options[] =
@@ -6,9 +9,104 @@ static const option long_options[] =
     {"map", required_argument, nullptr, 'm'},
     {"player", required_argument, nullptr, 'p'},
     {"ghost", required_argument, nullptr, 'g'},
+    {"engine", required_argument, nullptr, 'e'},
+    {"optimizer-stats", no_argument, nullptr, 'o'},
+    {"profile", required_argument, nullptr, 'f'},
+    {"trace", required_argument, nullptr, 't'},
+    {"ghost-threads", required_argument, nullptr, 'j'},
+    {"check-ghost-threads", no_argument, nullptr, 'c'},
+    {"lockstep", no_argument, nullptr, 'l'},
+    {"memo", no_argument, nullptr, 'M'},
+    {"validate-memo", required_argument, nullptr, 'V'},
+    {"headless", no_argument, nullptr, 'H'},
+    {"render-every", required_argument, nullptr, 'r'},
+    {"render-final", no_argument, nullptr, 'F'},
+    {"plain", no_argument, nullptr, 'P'},
+    {"render-thread", required_argument, nullptr, 'R'},
+    {"speed", required_argument, nullptr, 's'},
+    {"checkpoint", required_argument, nullptr, 'k'},
+    {"checkpoint-every", required_argument, nullptr, 'K'},
+    {"resume", required_argument, nullptr, 'u'},
+    {"record", required_argument, nullptr, 'w'},
+    {"keyframe-every", required_argument, nullptr, 'W'},
+    {"replay", required_argument, nullptr, 'y'},
+    {"seek", required_argument, nullptr, 'S'},
     {nullptr, 0, nullptr, '\0'}
 };
 
+static GhcEngine parseEngine(const string& str)
+{
+    if(str == "interpreter") { return GhcEngine::INTERPRETER; }
+    else if(str == "jit") { return GhcEngine::JIT; }
+    else if(str == "differential") { return GhcEngine::DIFFERENTIAL; }
+
+    throw runtime_error("--engine, -e must be interpreter, jit or differential");
+}
+
+// Superinstruction coverage and verification of each ghost program, on stderr
+static void printOptimizerStats(const Game& game, const vector<string>& ghostPaths)
+{
+    for(auto i = 0; i < game.ghostCount() && i < (int)ghostPaths.size(); i++)
+    {
+        auto& program = game.ghost(i).program();
+        auto& stats = program.optimizerStats();
+        auto ratio = stats.instructions == 0 ? 0.0 : 100.0 * stats.fused / stats.instructions;
+
+        cerr << ghostPaths[i] << ": " << stats.fused << " of " << stats.instructions
+             << " instructions fused (" << ratio << "%), " << stats.folded << " folded, "
+             << (program.verified() ? "verified" : "checked") << endl;
+    }
+}
+
+static FrameDropping parseDropping(const string& str)
+{
+    if(str == "block") { return FrameDropping::BLOCK; }
+    else if(str == "drop") { return FrameDropping::DROP_NEW; }
+    else if(str == "latest") { return FrameDropping::LATEST; }
+
+    throw runtime_error("--render-thread, -R must be block, drop or latest");
+}
+
+// One line of key=value pairs for scripts scoring headless games
+static void writeResult(ostream& os, const GameResult& result)
+{
+    os << "score=" << result.score << " lives=" << result.lives << " ticks=" << result.ticks
+       << " pills=" << result.pillsLeft << " end=" << gameEndName(result.end) << endl;
+}
+
+// Memo hit rates of every ghost, on stderr
+static void printMemoStats(const Game& game, const vector<string>& ghostPaths)
+{
+    for(auto i = 0; i < game.ghostCount(); i++)
+    {
+        auto& stats = game.ghost(i).memo()->stats();
+        auto ratio = stats.lookups == 0 ? 0.0 : 100.0 * stats.hits / stats.lookups;
+
+        cerr << "ghost " << i << " (" << ghostPaths[i % ghostPaths.size()] << "): "
+             << stats.hits << " of " << stats.lookups << " steps memoized (" << ratio << "%), "
+             << stats.validated << " validated, " << stats.stored << " stored, "
+             << stats.uncacheable << " uncacheable, " << stats.flushes << " flushes" << endl;
+    }
+}
+
+// Profile summary and annotated listing of every ghost
+static void writeProfiles(const Game& game, const vector<string>& ghostPaths, const string& path)
+{
+    ofstream os(path);
+
+    if(!os)
+    {
+        throw runtime_error("bad profile stream");
+    }
+
+    for(auto i = 0; i < game.ghostCount(); i++)
+    {
+        os << "ghost " << i << ": " << ghostPaths[i % ghostPaths.size()] << "\n";
+        writeProfile(os, *game.ghost(i).profile(), game.ghost(i).program());
+        os << "\n";
+    }
+}
+
 int main(int argc, char* argv[])
 {
     try
@@ -16,11 +114,34 @@ int main(int argc, char* argv[])
         string mapPath;
         string playerPath;
         vector<string> ghostPaths;
+        auto ghostEngine = GhcEngine::INTERPRETER;
+        auto optimizerStats = false;
+        string profilePath;
+        string tracePath;
+        auto ghostThreads = 1;
+        auto ghostScheduling = GhostScheduling::SERIAL;
+        auto lockstep = false;
+        auto memo = false;
+        auto validateMemo = 0;
+        auto headless = false;
+        auto renderEvery = 0;
+        auto renderFinal = false;
+        auto plain = false;
+        auto renderThread = false;
+        auto dropping = FrameDropping::BLOCK;
+        auto speed = 0.0;
+        string checkpointPath;
+        auto checkpointEvery = 100000;
+        string resumePath;
+        string recordPath;
+        auto keyframeEvery = 100000;
+        string replayPath;
+        auto seek = 0;
 
         while(true)
         {
             int index;
-            auto opt = getopt_long(argc, argv, "m:p:g:", long_options, &index);
+            auto opt = getopt_long(argc, argv, "m:p:g:e:of:t:j:clMV:Hr:FPR:s:k:K:u:w:W:y:S:", long_options, &index);
 
             if(opt < 0)
             {
@@ -38,27 +159,295 @@ int main(int argc, char* argv[])
                 case 'g':
                     ghostPaths.push_back(optarg);
                     break;
+                case 'e':
+                    ghostEngine = parseEngine(optarg);
+                    break;
+                case 'o':
+                    optimizerStats = true;
+                    break;
+                case 'f':
+                    profilePath = optarg;
+                    break;
+                case 't':
+                    tracePath = optarg;
+                    break;
+                case 'j':
+                    ghostThreads = atoi(optarg);
+                    break;
+                case 'c':
+                    ghostScheduling = GhostScheduling::CHECKED;
+                    break;
+                case 'l':
+                    lockstep = true;
+                    break;
+                case 'M':
+                    memo = true;
+                    break;
+                case 'V':
+                    memo = true;
+                    validateMemo = atoi(optarg);
+                    break;
+                case 'H':
+                    headless = true;
+                    break;
+                case 'r':
+                    headless = true;
+                    renderEvery = atoi(optarg);
+                    break;
+                case 'F':
+                    headless = true;
+                    renderFinal = true;
+                    break;
+                case 'P':
+                    plain = true;
+                    break;
+                case 'R':
+                    headless = true;
+                    renderThread = true;
+                    dropping = parseDropping(optarg);
+                    break;
+                case 's':
+                    speed = atof(optarg);
+
+                    if(speed <= 0.0)
+                    {
+                        throw runtime_error("--speed, -s must be above 0");
+                    }
+                    break;
+                case 'k':
+                    checkpointPath = optarg;
+                    break;
+                case 'K':
+                    checkpointEvery = atoi(optarg);
+
+                    if(checkpointEvery < 1)
+                    {
+                        throw runtime_error("--checkpoint-every, -K must be at least 1");
+                    }
+                    break;
+                case 'u':
+                    resumePath = optarg;
+                    break;
+                case 'w':
+                    recordPath = optarg;
+                    break;
+                case 'W':
+                    keyframeEvery = atoi(optarg);
+
+                    if(keyframeEvery < 1)
+                    {
+                        throw runtime_error("--keyframe-every, -W must be at least 1");
+                    }
+                    break;
+                case 'y':
+                    replayPath = optarg;
+                    break;
+                case 'S':
+                    seek = atoi(optarg);
+
+                    if(seek < 0)
+                    {
+                        throw runtime_error("--seek, -S must not be negative");
+                    }
+                    break;
             }
         }
 
-        if(mapPath.empty())
+        if(!replayPath.empty())
         {
-            throw runtime_error("--map, -m argument required");
+            if(!mapPath.empty() || !playerPath.empty() || !ghostPaths.empty() || !resumePath.empty())
+            {
+                throw runtime_error("--replay, -y comes with its own map, player and ghosts");
+            }
+
+            // the ghosts' VMs fall out of date as the replay moves them
+            if(!checkpointPath.empty() || !recordPath.empty())
+            {
+                throw runtime_error("--replay, -y cannot be checkpointed or recorded");
+            }
+
+            ghostPaths.push_back(replayPath);
         }
+        else if(!resumePath.empty())
+        {
+            if(!mapPath.empty() || !playerPath.empty() || !ghostPaths.empty())
+            {
+                throw runtime_error("--resume, -u comes with its own map, player and ghosts");
+            }
 
-        if(playerPath.empty())
+            // what stats and profiles name the ghosts by
+            ghostPaths.push_back(resumePath);
+        }
+        else if(mapPath.empty())
+        {
+            throw runtime_error("--map, -m argument required");
+        }
+        else if(playerPath.empty())
         {
             throw runtime_error("--player, -p argument required");
         }
-
-        if(ghostPaths.empty())
+        else if(ghostPaths.empty())
         {
             throw runtime_error("--ghost, -g argument required");
         }
 
+        if(ghostThreads < 1)
+        {
+            throw runtime_error("--ghost-threads, -j must be at least 1");
+        }
+
+        if(validateMemo < 0)
+        {
+            throw runtime_error("--validate-memo, -V must not be negative");
+        }
+
+        if(headless && speed > 0.0)
+        {
+            throw runtime_error("--speed, -s cannot be used headless");
+        }
+
+        if(renderEvery < 0)
+        {
+            throw runtime_error("--render-every, -r must not be negative");
+        }
+
+        // lockstep batches are formed from a whole tick's moves
+        if((ghostThreads > 1 || lockstep) && ghostScheduling == GhostScheduling::SERIAL)
+        {
+            ghostScheduling = GhostScheduling::PARALLEL;
+        }
+
         Game game;
-        game.init(mapPath, playerPath, ghostPaths);
-        game.run();
+        unique_ptr<ReplayReader> replay;
+
+        if(!replayPath.empty())
+        {
+            replay.reset(new ReplayReader(replayPath));
+            game.resume(replay->seek(Clock {seek}), ghostEngine);
+            game.replay(*replay);
+        }
+        else if(!resumePath.empty())
+        {
+            game.resume(readCheckpoint(resumePath), ghostEngine);
+        }
+        else
+        {
+            game.init(mapPath, playerPath, ghostPaths, ghostEngine);
+        }
+
+        game.setGhostScheduling(ghostScheduling, ghostThreads, lockstep);
+
+        int viewWidth;
+        int viewHeight;
+
+        if(headless)
+        {
+            game.setHeadless(renderEvery, renderFinal);
+
+            if(renderThread)
+            {
+                game.setRenderThread(dropping);
+            }
+        }
+        else if(!plain && terminalSize(viewWidth, viewHeight))
+        {
+            // watched on a terminal: redraw in place
+            game.setAnsi(viewWidth, viewHeight);
+        }
+
+        if(speed > 0.0)
+        {
+            game.setPlayback(speed);
+        }
+
+        if(optimizerStats)
+        {
+            printOptimizerStats(game, ghostPaths);
+        }
+
+        if(!profilePath.empty())
+        {
+            game.enableProfiling();
+        }
+
+        if(memo)
+        {
+            game.enableMemo(validateMemo);
+        }
+
+        unique_ptr<GhcTraceWriter> trace;
+
+        if(!tracePath.empty())
+        {
+            trace.reset(new GhcTraceWriter(tracePath, game.ghostCount()));
+            game.enableTracing(*trace);
+        }
+
+        unique_ptr<ReplayWriter> recorder;
+
+        if(!recordPath.empty())
+        {
+            recorder.reset(new ReplayWriter(recordPath, keyframeEvery));
+            game.record(*recorder);
+        }
+
+        if(replay)
+        {
+            // on from the keyframe sought, unseen
+            game.skipTo(Clock {seek});
+        }
+
+        if(checkpointPath.empty())
+        {
+            game.run();
+        }
+        else
+        {
+            // on every multiple of checkpointEvery, wherever the game began
+            auto next = game.clock().value / checkpointEvery * checkpointEvery + checkpointEvery;
+
+            while(game.runUntil(Clock {next}))
+            {
+                writeCheckpoint(checkpointPath, game.checkpoint());
+                next += checkpointEvery;
+            }
+        }
+
+        if(trace)
+        {
+            trace->close();
+        }
+
+        if(recorder)
+        {
+            recorder->close();
+        }
+
+        if(!profilePath.empty())
+        {
+            writeProfiles(game, ghostPaths, profilePath);
+        }
+
+        if(memo)
+        {
+            printMemoStats(game, ghostPaths);
+        }
+
+        if(speed > 0.0)
+        {
+            cerr << "playback: " << game.playback()->skipped() << " frames skipped" << endl;
+        }
+
+        if(renderThread)
+        {
+            cerr << "render thread: " << game.renderThread()->drawn() << " frames drawn, "
+                 << game.renderThread()->dropped() << " dropped" << endl;
+        }
+
+        if(headless)
+        {
+            writeResult(cout, game.result());
+        }
     }
     catch(const runtime_error& e)
     {
@@ -1,12 +1,17 @@
 #include "map.hpp"
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
 
 void Map::init(istream& is)
 {
     _width = 0;
     _height = 0;
-    _data.clear();
+    _tiles.clear();
+    _rows.clear();
+    auto squares = vector<char> {};
 
     if(!is)
     {
@@ -31,10 +36,29 @@ void Map::init(istream& is)
             throw runtime_error("mismatched map width");
         }
 
-        _data.insert(_data.end(), str.begin(), str.end());
+        squares.insert(squares.end(), str.begin(), str.end());
         _height++;
     }
 
+    for(auto y = 0; y < _height; y += TILE_ROWS)
+    {
+        auto begin = squares.begin() + y * _width;
+        auto end = squares.begin() + min(y + TILE_ROWS, _height) * _width;
+        _tiles.push_back(make_shared<Tile>(begin, end));
+
+        for(auto row = 0; row < TILE_ROWS && y + row < _height; row++)
+        {
+            _rows.push_back(_tiles.back()->data() + row * _width);
+        }
+    }
+
+    fill(begin(_counts), end(_counts), 0);
+
+    for(auto c : squares)
+    {
+        _counts[(uint8_t)c]++;
+    }
+
 #ifndef NDEBUG
     validate();
 #endif
@@ -43,13 +67,55 @@ void Map::init(istream& is)
 char Map::get(Position pos) const
 {
     assert(pos.x >= 0 && pos.x < _width && pos.y >= 0 && pos.y < _height);
-    return _data[pos.x + pos.y * _width];
+    return _rows[pos.y][pos.x];
 }
 
 void Map::set(Position pos, char ch)
 {
     assert(pos.x >= 0 && pos.x < _width && pos.y >= 0 && pos.y < _height);
-    _data[pos.x + pos.y * _width] = ch;
+    auto& tile = _tiles[pos.y / TILE_ROWS];
+
+    // another copy still reads these rows
+    if(tile.use_count() > 1)
+    {
+        auto first = pos.y / TILE_ROWS * TILE_ROWS;
+        tile = make_shared<Tile>(*tile);
+
+        for(auto row = 0; row < TILE_ROWS && first + row < _height; row++)
+        {
+            _rows[first + row] = tile->data() + row * _width;
+        }
+    }
+
+    auto& square = _rows[pos.y][pos.x];
+    _counts[(uint8_t)square]--;
+    _counts[(uint8_t)ch]++;
+    square = ch;
+}
+
+int Map::count(char ch) const
+{
+#ifdef LAMCO_CHECK_COUNTS
+    auto found = 0;
+
+    for(auto y = 0; y < _height; y++)
+    {
+        found += std::count(_rows[y], _rows[y] + _width, ch);
+    }
+
+    if(found != _counts[(uint8_t)ch])
+    {
+        throw logic_error("map square count out of date");
+    }
+#endif
+
+    return _counts[(uint8_t)ch];
+}
+
+const char* Map::row(int y) const
+{
+    assert(y >= 0 && y < _height);
+    return _rows[y];
 }
 
 int Map::width() const
@@ -74,20 +140,23 @@ void Map::validate() const
         throw runtime_error("map too tall");
     }
 
-    for(auto c : _data)
+    for(auto y = 0; y < _height; y++)
     {
-        switch(c)
+        for(auto x = 0; x < _width; x++)
         {
-            case '#': // wall
-            case ' ': // space
-            case '.': // pill
-            case 'o': // power pill
-            case '\\': // lambda man
-            case '=': // ghost
-            case '%': // fruit
-                break;
-            default:
-                throw runtime_error("map has invalid character");
+            switch(get({x, y}))
+            {
+                case '#': // wall
+                case ' ': // space
+                case '.': // pill
+                case 'o': // power pill
+                case '\\': // lambda man
+                case '=': // ghost
+                case '%': // fruit
+                    break;
+                default:
+                    throw runtime_error("map has invalid character");
+            }
         }
     }
 
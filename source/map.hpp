@@ -3,10 +3,14 @@
 
 #include "basic.hpp"
 #include <iostream>
+#include <memory>
 #include <vector>
 
 using namespace std;
 
+// Copies of a map share its squares, a few rows at a time, until one of
+// them sets a square in those rows, so copying costs about the height
+// of the map rather than its area
 class Map
 {
 public:
@@ -14,16 +18,29 @@ public:
 
     char get(Position pos) const;
     void set(Position pos, char ch);
+    // Squares holding ch, kept up to date by set(). Build with
+    // LAMCO_CHECK_COUNTS defined to check each against a full scan.
+    int count(char ch) const;
+    // the width() squares of row y
+    const char* row(int y) const;
 
     int width() const;
     int height() const;
 
 private:
+    static const int TILE_ROWS = 4;
+
+    // TILE_ROWS rows of squares, or fewer in the last tile
+    typedef vector<char> Tile;
+
     void validate() const;
 
     int _width;
     int _height;
-    vector<char> _data;
+    vector<shared_ptr<Tile>> _tiles;
+    // where each row starts in its tile
+    vector<char*> _rows;
+    int _counts[256];
 };
 
 #endif
\ No newline at end of file
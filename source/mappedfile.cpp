@@ -0,0 +1,58 @@
+#include "mappedfile.hpp"
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const string& path) :
+    _data(nullptr),
+    _size(0)
+{
+    auto fd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+
+    if(fd < 0 || fstat(fd, &info) != 0)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+
+        throw runtime_error("bad input stream");
+    }
+
+    _size = info.st_size;
+
+    // an empty file can't be mapped but reads fine as nothing
+    if(_size > 0)
+    {
+        _data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    close(fd);
+
+    if(_data == MAP_FAILED)
+    {
+        throw runtime_error("bad input stream");
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if(_data)
+    {
+        munmap(_data, _size);
+    }
+}
+
+const char* MappedFile::data() const
+{
+    return (const char*)_data;
+}
+
+size_t MappedFile::size() const
+{
+    return _size;
+}
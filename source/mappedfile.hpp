@@ -0,0 +1,27 @@
+#ifndef LAMCO_MAPPEDFILE_HPP
+#define LAMCO_MAPPEDFILE_HPP
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+// A whole file mapped read-only into memory
+class MappedFile
+{
+public:
+    explicit MappedFile(const string& path);
+    ~MappedFile();
+
+    const char* data() const;
+    size_t size() const;
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    void* _data;
+    size_t _size;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "memo.hpp"
+#include <cstring>
+#include <stdexcept>
+
+// Bound the memory of one ghost's memo to about a megabyte, so 256 ghosts
+// stay near 256 MB. Each root holds a whole GhcMemoKey, so roots rather
+// than nodes dominate; a hash table entry also costs a next pointer, a
+// cached hash and a bucket.
+static const size_t MAX_BYTES = 1 << 20;
+static const size_t HASH_ENTRY_BYTES = 3 * sizeof(void*);
+static const size_t ROOT_BYTES = sizeof(GhcMemoKey) + sizeof(int) + HASH_ENTRY_BYTES;
+static const size_t EDGE_BYTES = sizeof(uint64_t) + sizeof(int) + HASH_ENTRY_BYTES;
+
+static uint64_t edgeKey(int node, const uint8_t* out)
+{
+    return (uint64_t)node << 16 | out[0] << 8 | out[1];
+}
+
+// 64-bit FNV-1a
+size_t GhcMemo::KeyHash::operator()(const GhcMemoKey& key) const
+{
+    auto bytes = (const uint8_t*)&key;
+    auto hash = uint64_t {0xcbf29ce484222325};
+
+    for(auto i = size_t {0}; i < sizeof(key); i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+bool GhcMemo::KeyEqual::operator()(const GhcMemoKey& a, const GhcMemoKey& b) const
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+GhcMemo::GhcMemo(int validateEvery) :
+    _validateEvery(validateEvery),
+    _recording(false),
+    _cacheable(false),
+    _entry(),
+    _stats()
+{
+}
+
+int GhcMemo::find(const GhcMemoKey& key)
+{
+    _stats.lookups++;
+
+    auto it = _roots.find(key);
+    return it == _roots.end() ? -1 : it->second;
+}
+
+int GhcMemo::next(int node, const uint8_t* out) const
+{
+    auto it = _edges.find(edgeKey(node, out));
+    return it == _edges.end() ? -1 : it->second;
+}
+
+const GhcMemoNode& GhcMemo::node(int node) const
+{
+    return _nodes[node];
+}
+
+const GhcMemoWrite* GhcMemo::writes() const
+{
+    return _writes.data();
+}
+
+bool GhcMemo::hit()
+{
+    _stats.hits++;
+
+    if(_validateEvery > 0 && _stats.hits % _validateEvery == 0)
+    {
+        _stats.validated++;
+        return true;
+    }
+
+    return false;
+}
+
+void GhcMemo::begin(const GhcMemoKey& key)
+{
+    _recording = true;
+    _cacheable = true;
+    _entry = key;
+    _observations.clear();
+}
+
+void GhcMemo::record(const GhcObservation& observation)
+{
+    if(_recording)
+    {
+        _observations.push_back(observation);
+    }
+}
+
+void GhcMemo::spoil()
+{
+    _cacheable = false;
+}
+
+void GhcMemo::finish(const uint8_t* registers, const uint8_t* data, Direction direction)
+{
+    if(!_recording)
+    {
+        return;
+    }
+
+    _recording = false;
+
+    if(!_cacheable)
+    {
+        _stats.uncacheable++;
+        return;
+    }
+
+    // at most a root, a node and edge per read, an outcome and a write
+    // per data address
+    auto worst = ROOT_BYTES +
+        _observations.size() * (sizeof(GhcMemoNode) + EDGE_BYTES) +
+        sizeof(GhcMemoNode) +
+        GHC_DATA_SIZE * sizeof(GhcMemoWrite);
+
+    if(bytes() + worst > MAX_BYTES)
+    {
+        clear();
+        _stats.flushes++;
+    }
+
+    auto root = _roots.find(_entry);
+    auto node = 0;
+
+    if(root == _roots.end())
+    {
+        node = addNode();
+        _roots.emplace(_entry, node);
+    }
+    else
+    {
+        node = root->second;
+    }
+
+    for(auto& observation : _observations)
+    {
+        auto& read = _nodes[node];
+
+        if(read.kind == GhcMemoNode::EMPTY)
+        {
+            read.kind = GhcMemoNode::READ;
+            read.read = observation;
+        }
+        else if(read.kind != GhcMemoNode::READ ||
+            read.read.num != observation.num ||
+            read.read.in[0] != observation.in[0] ||
+            read.read.in[1] != observation.in[1])
+        {
+            throw logic_error("ghost step is not deterministic");
+        }
+
+        auto edge = edgeKey(node, observation.out);
+        auto it = _edges.find(edge);
+
+        if(it == _edges.end())
+        {
+            auto child = addNode();
+            _edges.emplace(edge, child);
+            node = child;
+        }
+        else
+        {
+            node = it->second;
+        }
+    }
+
+    auto& outcome = _nodes[node];
+
+    if(outcome.kind != GhcMemoNode::EMPTY)
+    {
+        return;
+    }
+
+    outcome.kind = GhcMemoNode::OUTCOME;
+    memcpy(outcome.registers, registers, sizeof(outcome.registers));
+    outcome.direction = direction;
+    outcome.writesBegin = _writes.size();
+
+    for(auto address = 0; address < GHC_DATA_SIZE; address++)
+    {
+        if(data[address] != _entry.data[address])
+        {
+            _writes.push_back(GhcMemoWrite {(uint8_t)address, data[address]});
+        }
+    }
+
+    outcome.writesEnd = _writes.size();
+    _stats.stored++;
+}
+
+const GhcMemoStats& GhcMemo::stats() const
+{
+    return _stats;
+}
+
+int GhcMemo::addNode()
+{
+    _nodes.push_back(GhcMemoNode());
+    return _nodes.size() - 1;
+}
+
+size_t GhcMemo::bytes() const
+{
+    return _roots.size() * ROOT_BYTES +
+        _nodes.size() * sizeof(GhcMemoNode) +
+        _edges.size() * EDGE_BYTES +
+        _writes.size() * sizeof(GhcMemoWrite);
+}
+
+void GhcMemo::clear()
+{
+    _roots.clear();
+    _nodes.clear();
+    _edges.clear();
+    _writes.clear();
+}
@@ -0,0 +1,128 @@
+#ifndef LAMCO_MEMO_HPP
+#define LAMCO_MEMO_HPP
+
+#include "ghost.hpp"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// One read of the game by interrupt num: A and B going in and coming out
+struct GhcObservation
+{
+    uint8_t num;
+    uint8_t in[2];
+    uint8_t out[2];
+};
+
+// A ghost's VM state when a step starts
+struct GhcMemoKey
+{
+    uint8_t registers[9];
+    uint8_t data[GHC_DATA_SIZE];
+    uint8_t direction;
+};
+
+struct GhcMemoWrite
+{
+    uint8_t address;
+    uint8_t value;
+};
+
+struct GhcMemoNode
+{
+    enum Kind : uint8_t
+    {
+        // reached, but no step has ended here yet
+        EMPTY,
+        // the step reads the game next
+        READ,
+        // the step ends
+        OUTCOME
+    };
+
+    Kind kind;
+    // READ: num and in of the read
+    GhcObservation read;
+    // OUTCOME: the VM when the step ended; data changes are writes
+    // [writesBegin, writesEnd) of the memo
+    uint8_t registers[9];
+    Direction direction;
+    uint32_t writesBegin;
+    uint32_t writesEnd;
+};
+
+struct GhcMemoStats
+{
+    uint64_t lookups;
+    uint64_t hits;
+    // hits checked by running the program anyway
+    uint64_t validated;
+    // steps recorded, and those that could not be, having traced
+    uint64_t stored;
+    uint64_t uncacheable;
+    // times the memo filled up and started over
+    uint64_t flushes;
+};
+
+// The decisions of one ghost. A program is deterministic, so from one
+// state a step always reads the game in the same order with the same
+// arguments; each state roots a tree that branches on what the reads
+// returned and ends in the step's outcome.
+class GhcMemo
+{
+public:
+    // validateEvery: check every nth hit against the program, or 0 for none
+    explicit GhcMemo(int validateEvery);
+
+    // The node for a step starting in key, or -1
+    int find(const GhcMemoKey& key);
+    // The node after node's read returned out, or -1
+    int next(int node, const uint8_t* out) const;
+    const GhcMemoNode& node(int node) const;
+    const GhcMemoWrite* writes() const;
+    // Counts a hit, returning whether to validate it
+    bool hit();
+
+    // Recording a step that missed
+    void begin(const GhcMemoKey& key);
+    void record(const GhcObservation& observation);
+    // The step did something that replaying it would not
+    void spoil();
+    void finish(const uint8_t* registers, const uint8_t* data, Direction direction);
+
+    const GhcMemoStats& stats() const;
+
+private:
+    struct KeyHash
+    {
+        size_t operator()(const GhcMemoKey& key) const;
+    };
+
+    struct KeyEqual
+    {
+        bool operator()(const GhcMemoKey& a, const GhcMemoKey& b) const;
+    };
+
+    int addNode();
+    // Roughly what the memo holds, in bytes
+    size_t bytes() const;
+    void clear();
+
+    int _validateEvery;
+    unordered_map<GhcMemoKey, int, KeyHash, KeyEqual> _roots;
+    vector<GhcMemoNode> _nodes;
+    // node << 16 | out[0] << 8 | out[1] to the node after that read
+    unordered_map<uint64_t, int> _edges;
+    vector<GhcMemoWrite> _writes;
+
+    bool _recording;
+    bool _cacheable;
+    GhcMemoKey _entry;
+    vector<GhcObservation> _observations;
+
+    GhcMemoStats _stats;
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "native.hpp"
+#include <map>
+#include <stdexcept>
+#include <string>
+
+static map<uint64_t, GhcCompiledModule>& compiledModules()
+{
+    static map<uint64_t, GhcCompiledModule> modules;
+    return modules;
+}
+
+GhcModuleRegistration::GhcModuleRegistration(uint64_t hash, const char* name, GhcNativeEntry entry, const uint8_t* code, int size)
+{
+    auto& modules = compiledModules();
+    auto it = modules.find(hash);
+
+    // one would silently shadow the other
+    if(it != modules.end())
+    {
+        throw logic_error("compiled modules " + string(it->second.name) + " and " + name + " have the same source hash");
+    }
+
+    modules[hash] = GhcCompiledModule {hash, name, entry, code, size};
+}
+
+const GhcCompiledModule* findCompiledModule(uint64_t hash)
+{
+    auto& modules = compiledModules();
+    auto it = modules.find(hash);
+
+    if(it == modules.end())
+    {
+        return nullptr;
+    }
+
+    return &it->second;
+}
+
+// 64-bit FNV-1a over the program source
+uint64_t hashProgram(const char* source, size_t size)
+{
+    auto hash = uint64_t {0xcbf29ce484222325};
+
+    for(auto i = size_t {0}; i < size; i++)
+    {
+        hash ^= (uint8_t)source[i];
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+uint64_t hashProgram(const string& source)
+{
+    return hashProgram(source.data(), source.size());
+}
@@ -0,0 +1,56 @@
+#ifndef LAMCO_NATIVE_HPP
+#define LAMCO_NATIVE_HPP
+
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+// Everything native ghost code touches lives at a fixed offset in here
+struct GhcNativeContext
+{
+    uint8_t* registers;
+    uint8_t* data;
+    int fuel;
+    // returns nonzero if the interrupt failed
+    int (*interrupt)(GhcNativeContext* context, int num);
+    void* user;
+};
+
+enum class GhcNativeStatus
+{
+    // stopped at a HLT, PC points at it
+    HALTED,
+    // the interpreter must finish the step from PC with the remaining fuel
+    CONTINUE,
+    // the interrupt callback failed
+    FAILED
+};
+
+// Runs one step of a ghost program, returning a GhcNativeStatus
+typedef int (*GhcNativeEntry)(GhcNativeContext* context);
+
+// A ghost program translated ahead of time by ghc2cpp
+struct GhcCompiledModule
+{
+    uint64_t hash;
+    const char* name;
+    GhcNativeEntry entry;
+    // the program it was translated from, as .ghcb instruction records, so
+    // a program whose source hash merely collides can tell it isn't its own
+    const uint8_t* code;
+    int size;
+};
+
+// Generated modules register themselves through a static instance of this.
+// Throws logic_error if a module for the same hash is already registered.
+struct GhcModuleRegistration
+{
+    GhcModuleRegistration(uint64_t hash, const char* name, GhcNativeEntry entry, const uint8_t* code, int size);
+};
+
+const GhcCompiledModule* findCompiledModule(uint64_t hash);
+uint64_t hashProgram(const char* source, size_t size);
+uint64_t hashProgram(const string& source);
+
+#endif
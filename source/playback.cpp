@@ -0,0 +1,152 @@
+#include "playback.hpp"
+#include <poll.h>
+#include <stdexcept>
+#include <thread>
+#include <unistd.h>
+
+// late by more than this, a frame is skipped
+static const auto LATE = chrono::milliseconds(50);
+// but never so many that nothing is drawn for this long
+static const auto MAX_GAP = chrono::milliseconds(250);
+// sleep until this close, then yield until the frame is due
+static const auto SPIN = chrono::milliseconds(2);
+static const int PAUSE_POLL_MS = 100;
+
+Playback::Playback(double speed) :
+    _speed(speed),
+    _paused(false),
+    _step(false),
+    _eof(false),
+    _anchored(false),
+    _anchorClock(0),
+    _skipped(0),
+    _terminal(false)
+{
+    if(speed <= 0.0)
+    {
+        throw runtime_error("playback speed must be above 0");
+    }
+
+    if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &_savedTerminal) == 0)
+    {
+        // keys arrive one at a time, unechoed
+        auto raw = _savedTerminal;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        _terminal = tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+    }
+}
+
+Playback::~Playback()
+{
+    if(_terminal)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &_savedTerminal);
+    }
+}
+
+bool Playback::pace(int clock)
+{
+    readKeys(0);
+
+    while(_paused)
+    {
+        if(_step)
+        {
+            _step = false;
+            _anchored = false;
+            return true;
+        }
+
+        readKeys(PAUSE_POLL_MS);
+    }
+
+    if(!_anchored)
+    {
+        anchor(clock);
+        return true;
+    }
+
+    auto seconds = (clock - _anchorClock) / (PLAYBACK_TICKS_PER_SECOND * _speed);
+    auto due = _anchorTime + chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+    auto now = Clock::now();
+
+    if(now > due + LATE && now - _lastDrawn < MAX_GAP)
+    {
+        _skipped++;
+        return false;
+    }
+
+    if(due - now > SPIN)
+    {
+        this_thread::sleep_until(due - SPIN);
+    }
+
+    while(Clock::now() < due)
+    {
+        this_thread::yield();
+    }
+
+    _lastDrawn = Clock::now();
+    return true;
+}
+
+uint64_t Playback::skipped() const
+{
+    return _skipped;
+}
+
+void Playback::readKeys(int timeoutMs)
+{
+    while(!_eof)
+    {
+        auto fd = pollfd {STDIN_FILENO, POLLIN, 0};
+
+        if(poll(&fd, 1, timeoutMs) <= 0)
+        {
+            return;
+        }
+
+        char key;
+
+        if(read(STDIN_FILENO, &key, 1) != 1)
+        {
+            _eof = true;
+            return;
+        }
+
+        // only the first poll waits
+        timeoutMs = 0;
+
+        switch(key)
+        {
+            case ' ':
+                _paused = !_paused;
+                _anchored = false;
+                break;
+            case '.':
+                _step = _paused;
+                break;
+            case '+':
+                _speed *= 2;
+                _anchored = false;
+                break;
+            case '-':
+                _speed /= 2;
+                _anchored = false;
+                break;
+        }
+    }
+
+    // nothing more will come, so never stay paused
+    _paused = false;
+}
+
+void Playback::anchor(int clock)
+{
+    _anchored = true;
+    _anchorClock = clock;
+    _anchorTime = Clock::now();
+    _lastDrawn = _anchorTime;
+}
@@ -0,0 +1,56 @@
+#ifndef LAMCO_PLAYBACK_HPP
+#define LAMCO_PLAYBACK_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <termios.h>
+
+using namespace std;
+
+// game ticks a second at 1x: five player moves
+static const double PLAYBACK_TICKS_PER_SECOND = 127 * 5;
+
+// Paces frames to the wall clock at speed times real time. Keys are read
+// from stdin as they come, without echo:
+//   space pauses and resumes, '.' steps a frame while paused,
+//   '+' and '-' double and halve the speed
+class Playback
+{
+public:
+    explicit Playback(double speed);
+    // puts the terminal back
+    ~Playback();
+
+    // Waits until the frame at clock is due. Returns false to skip drawing
+    // it, when playback has fallen behind.
+    bool pace(int clock);
+
+    uint64_t skipped() const;
+
+private:
+    typedef chrono::steady_clock Clock;
+
+    Playback(const Playback&);
+    Playback& operator=(const Playback&);
+
+    // handles keys waiting on stdin, or waits up to timeout for one
+    void readKeys(int timeoutMs);
+    void anchor(int clock);
+
+    double _speed;
+    bool _paused;
+    bool _step;
+    bool _eof;
+
+    // frames are due relative to the frame at _anchorClock
+    bool _anchored;
+    int _anchorClock;
+    Clock::time_point _anchorTime;
+    Clock::time_point _lastDrawn;
+    uint64_t _skipped;
+
+    bool _terminal;
+    termios _savedTerminal;
+};
+
+#endif
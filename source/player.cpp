@@ -27,7 +27,23 @@ void Player::reset()
     _position = _startPosition;
 }
 
+void Player::place(Position pos, Direction direction)
+{
+    _position = pos;
+    _direction = direction;
+}
+
+Position Player::startPosition() const
+{
+    return _startPosition;
+}
+
 Position Player::position() const
 {
     return _position;
-}
\ No newline at end of file
+}
+
+Direction Player::direction() const
+{
+    return _direction;
+}
@@ -14,8 +14,12 @@ public:
 
     void step(const Map& map);
     void reset();
+    // Puts the player where a checkpoint found it
+    void place(Position pos, Direction direction);
 
+    Position startPosition() const;
     Position position() const;
+    Direction direction() const;
 
 private:
     Position _startPosition;
@@ -0,0 +1,64 @@
+#include "profile.hpp"
+#include <iomanip>
+
+static const char* interruptName(int num)
+{
+    switch(num)
+    {
+        case 0: return "set direction";
+        case 1: return "player position";
+        case 2: return "player 2 position";
+        case 3: return "ghost index";
+        case 4: return "ghost start position";
+        case 5: return "ghost position";
+        case 6: return "ghost status";
+        case 7: return "map square";
+        case 8: return "trace";
+    }
+
+    return "unknown";
+}
+
+static double percent(uint64_t part, uint64_t whole)
+{
+    return whole == 0 ? 0.0 : 100.0 * part / whole;
+}
+
+void writeProfile(ostream& os, const GhcProfile& profile, const GhcProgram& program)
+{
+    auto flags = os.flags();
+    auto precision = os.precision();
+    os << fixed << setprecision(1);
+
+    os << "steps: " << profile.steps << ", " << profile.halted << " halted, "
+       << profile.exhausted << " out of instructions\n";
+    os << "instructions per step: "
+       << (profile.steps == 0 ? 0.0 : (double)profile.instructions / profile.steps)
+       << " average, " << profile.maxInstructions << " max\n";
+
+    for(auto num = 0; num < 256; num++)
+    {
+        if(profile.interrupts[num] > 0)
+        {
+            os << "int " << num << " (" << interruptName(num) << "): "
+               << profile.interrupts[num] << " calls\n";
+        }
+    }
+
+    auto& code = program.code();
+    auto total = uint64_t {0};
+
+    for(auto pc = 0u; pc < code.size(); pc++)
+    {
+        total += profile.hits[pc];
+    }
+
+    for(auto pc = 0u; pc < code.size(); pc++)
+    {
+        os << setw(12) << profile.hits[pc] << setw(7) << percent(profile.hits[pc], total) << "%"
+           << setw(5) << pc << "  " << formatInstruction(code[pc]) << "\n";
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
@@ -0,0 +1,29 @@
+#ifndef LAMCO_PROFILE_HPP
+#define LAMCO_PROFILE_HPP
+
+#include "ghost.hpp"
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+// What one ghost's program did over a game, collected when profiling is on
+struct GhcProfile
+{
+    // executions of the instruction at each PC
+    uint64_t hits[256];
+    // calls to each interrupt number
+    uint64_t interrupts[256];
+    uint64_t steps;
+    // steps ended by HLT and by running out of instructions
+    uint64_t halted;
+    uint64_t exhausted;
+    // instructions charged, over all steps and for the longest step
+    uint64_t instructions;
+    uint64_t maxInstructions;
+};
+
+// Writes the summary and an annotated listing of the program
+void writeProfile(ostream& os, const GhcProfile& profile, const GhcProgram& program);
+
+#endif
@@ -0,0 +1,266 @@
+#include "render.hpp"
+#include "ghostpool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+static const auto IDLE_WAIT = chrono::milliseconds(1);
+
+bool terminalSize(int& width, int& height)
+{
+    winsize size;
+
+    if(!isatty(STDOUT_FILENO) || ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0 ||
+        size.ws_col == 0 || size.ws_row == 0)
+    {
+        return false;
+    }
+
+    width = size.ws_col;
+    height = size.ws_row;
+    return true;
+}
+
+void Frame::capture(const Map& map, Position playerPos, const GhostPool& pool)
+{
+    width = map.width();
+    height = map.height();
+    squares.resize(width * height);
+
+    for(auto y = 0; y < height; y++)
+    {
+        copy(map.row(y), map.row(y) + width, squares.begin() + y * width);
+    }
+    player = playerPos;
+    ghosts.resize(pool.size());
+
+    for(auto i = 0; i < pool.size(); i++)
+    {
+        ghosts[i] = pool.position(i);
+    }
+}
+
+Renderer::Renderer() :
+    _ansi(false),
+    _viewWidth(0),
+    _viewHeight(0),
+    _left(0),
+    _top(0),
+    _width(0),
+    _height(0)
+{
+}
+
+void Renderer::setPlain()
+{
+    _ansi = false;
+}
+
+void Renderer::setAnsi(int viewWidth, int viewHeight)
+{
+    _ansi = true;
+    _viewWidth = max(viewWidth, 1);
+    _viewHeight = max(viewHeight - 1, 1);
+    _shown.clear();
+}
+
+void Renderer::draw(ostream& os, const Frame& frame)
+{
+    _out.clear();
+
+    if(!_ansi)
+    {
+        _left = 0;
+        _top = 0;
+        _width = frame.width;
+        _height = frame.height;
+        compose(frame);
+
+        for(auto y = 0; y < _height; y++)
+        {
+            _out.append(&_squares[y * _width], _width);
+            _out += '\n';
+        }
+
+        os.write(_out.data(), _out.size());
+        return;
+    }
+
+    auto width = min(_viewWidth, frame.width);
+    auto height = min(_viewHeight, frame.height);
+
+    if(_shown.empty() || width != _width || height != _height)
+    {
+        // start over on a clear screen
+        _width = width;
+        _height = height;
+        _shown.assign(_width * _height, 0);
+        _out += "\x1b[H\x1b[2J";
+    }
+
+    // keep the player in the middle, as far as the edges allow
+    _left = max(0, min(frame.player.x - _width / 2, frame.width - _width));
+    _top = max(0, min(frame.player.y - _height / 2, frame.height - _height));
+    compose(frame);
+
+    for(auto y = 0; y < _height; y++)
+    {
+        // the cursor follows a run of changes without moving it
+        auto cursor = -1;
+
+        for(auto x = 0; x < _width; x++)
+        {
+            auto i = y * _width + x;
+
+            if(_squares[i] == _shown[i])
+            {
+                continue;
+            }
+
+            if(cursor != x)
+            {
+                appendMove(x, y);
+            }
+
+            _out += _squares[i];
+            _shown[i] = _squares[i];
+            cursor = x + 1;
+        }
+    }
+
+    appendMove(0, _height);
+    os.write(_out.data(), _out.size());
+    os.flush();
+}
+
+void Renderer::compose(const Frame& frame)
+{
+    _squares.resize(_width * _height);
+
+    for(auto y = 0; y < _height; y++)
+    {
+        memcpy(&_squares[y * _width], &frame.squares[(_top + y) * frame.width + _left], _width);
+    }
+
+    auto overlay = [this](Position pos, char ch)
+    {
+        auto x = pos.x - _left;
+        auto y = pos.y - _top;
+
+        if(x >= 0 && x < _width && y >= 0 && y < _height)
+        {
+            _squares[y * _width + x] = ch;
+        }
+    };
+
+    // ghosts cover the player
+    overlay(frame.player, '\\');
+
+    for(auto ghost : frame.ghosts)
+    {
+        overlay(ghost, '=');
+    }
+}
+
+// ANSI rows and columns count from 1
+void Renderer::appendMove(int x, int y)
+{
+    _out += "\x1b[";
+    _out += to_string(y + 1);
+    _out += ';';
+    _out += to_string(x + 1);
+    _out += 'H';
+}
+
+RenderThread::RenderThread(Renderer& renderer, ostream& os, FrameDropping dropping) :
+    _renderer(renderer),
+    _os(os),
+    _dropping(dropping),
+    _head(0),
+    _tail(0),
+    _drawn(0),
+    _dropped(0),
+    _stopping(false)
+{
+    _thread = thread(&RenderThread::run, this);
+}
+
+RenderThread::~RenderThread()
+{
+    close();
+}
+
+void RenderThread::push(const Map& map, Position player, const GhostPool& ghosts, bool keep)
+{
+    auto head = _head.load(memory_order_relaxed);
+
+    while(head - _tail.load(memory_order_acquire) == CAPACITY)
+    {
+        if(!keep && _dropping != FrameDropping::BLOCK)
+        {
+            _dropped.fetch_add(1, memory_order_relaxed);
+            return;
+        }
+
+        this_thread::yield();
+    }
+
+    _frames[head % CAPACITY].capture(map, player, ghosts);
+    _head.store(head + 1, memory_order_release);
+}
+
+void RenderThread::close()
+{
+    if(!_thread.joinable())
+    {
+        return;
+    }
+
+    _stopping.store(true);
+    _thread.join();
+    _os.flush();
+}
+
+uint64_t RenderThread::drawn() const
+{
+    return _drawn.load();
+}
+
+uint64_t RenderThread::dropped() const
+{
+    return _dropped.load();
+}
+
+void RenderThread::run()
+{
+    while(true)
+    {
+        // read before head, so nothing pushed before close() is missed
+        auto stopping = _stopping.load();
+        auto tail = _tail.load(memory_order_relaxed);
+        auto head = _head.load(memory_order_acquire);
+
+        if(tail == head)
+        {
+            if(stopping)
+            {
+                return;
+            }
+
+            this_thread::sleep_for(IDLE_WAIT);
+            continue;
+        }
+
+        if(_dropping == FrameDropping::LATEST && head - tail > 1)
+        {
+            _dropped.fetch_add(head - 1 - tail, memory_order_relaxed);
+            tail = head - 1;
+        }
+
+        _renderer.draw(_os, _frames[tail % CAPACITY]);
+        _drawn.fetch_add(1, memory_order_relaxed);
+        _tail.store(tail + 1, memory_order_release);
+    }
+}
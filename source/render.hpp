@@ -0,0 +1,120 @@
+#ifndef LAMCO_RENDER_HPP
+#define LAMCO_RENDER_HPP
+
+#include "basic.hpp"
+#include "map.hpp"
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+class GhostPool;
+
+// The size of the terminal on stdout, if it is one
+bool terminalSize(int& width, int& height);
+
+// What a frame shows, copied out of the game so it can be drawn while the
+// game goes on
+struct Frame
+{
+    int width;
+    int height;
+    // the map
+    vector<char> squares;
+    Position player;
+    vector<Position> ghosts;
+
+    void capture(const Map& map, Position playerPos, const GhostPool& pool);
+};
+
+// Draws frames of a game into one buffer, written with one call. Plain
+// frames are the whole map as lines of text. ANSI frames show a viewport
+// that follows the player and only redraw the squares that changed since
+// the last frame.
+class Renderer
+{
+public:
+    Renderer();
+
+    void setPlain();
+    // viewWidth by viewHeight squares, leaving the line below for input
+    void setAnsi(int viewWidth, int viewHeight);
+
+    void draw(ostream& os, const Frame& frame);
+
+private:
+    // the squares in view: the map with the player and ghosts on top
+    void compose(const Frame& frame);
+    void appendMove(int x, int y);
+
+    bool _ansi;
+    int _viewWidth;
+    int _viewHeight;
+
+    // map coordinates of the top left square in view
+    int _left;
+    int _top;
+    // size of the view this frame, no larger than the map
+    int _width;
+    int _height;
+    vector<char> _squares;
+    // what the terminal shows; 0 where unknown
+    vector<char> _shown;
+    string _out;
+};
+
+// What a render thread does with frames the game makes faster than it
+// draws them
+enum class FrameDropping
+{
+    // the game waits, so every frame is drawn
+    BLOCK,
+    // frames made while the queue is full are dropped
+    DROP_NEW,
+    // the thread skips to the newest frame queued
+    LATEST
+};
+
+// Draws frames with renderer on a thread of its own. Frames pass through a
+// single-producer single-consumer ring, so the game never takes a lock.
+class RenderThread
+{
+public:
+    RenderThread(Renderer& renderer, ostream& os, FrameDropping dropping);
+    ~RenderThread();
+
+    // Queues a frame, or drops it as dropping says unless keep
+    void push(const Map& map, Position player, const GhostPool& ghosts, bool keep);
+    // Stops the thread once every frame queued has been drawn
+    void close();
+
+    uint64_t drawn() const;
+    uint64_t dropped() const;
+
+private:
+    // triple buffered: one frame drawing, one queued, one filling
+    static const uint64_t CAPACITY = 3;
+
+    RenderThread(const RenderThread&);
+    RenderThread& operator=(const RenderThread&);
+
+    void run();
+
+    Renderer& _renderer;
+    ostream& _os;
+    FrameDropping _dropping;
+    Frame _frames[CAPACITY];
+    // total frames queued and finished with; only the owning side writes each
+    atomic<uint64_t> _head;
+    atomic<uint64_t> _tail;
+    atomic<uint64_t> _drawn;
+    atomic<uint64_t> _dropped;
+    atomic<bool> _stopping;
+    thread _thread;
+};
+
+#endif
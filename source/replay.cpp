@@ -0,0 +1,260 @@
+#include "replay.hpp"
+#include "endian.hpp"
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+static void appendVarint(string& str, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        str += (char)(value | 0x80);
+        value >>= 7;
+    }
+
+    str += (char)value;
+}
+
+// magic, version, keyframeEvery
+static const size_t HEADER_SIZE = 10;
+// tag, size
+static const size_t CHUNK_HEADER_SIZE = 5;
+
+ReplayWriter::ReplayWriter(const string& path, int keyframeEvery) :
+    _os(path, ios::binary),
+    _keyframeEvery(keyframeEvery),
+    _clock(),
+    _actor(-1)
+{
+    if(!_os)
+    {
+        throw runtime_error("bad replay stream");
+    }
+
+    if(keyframeEvery < 1)
+    {
+        throw runtime_error("keyframes must be at least a tick apart");
+    }
+
+    _os.write("LMRP", 4);
+    writeLittleEndian(_os, REPLAY_VERSION, 2);
+    writeLittleEndian(_os, keyframeEvery, 4);
+}
+
+ReplayWriter::~ReplayWriter()
+{
+    close();
+}
+
+int ReplayWriter::keyframeEvery() const
+{
+    return _keyframeEvery;
+}
+
+void ReplayWriter::keyframe(Clock clock, const GameCheckpoint& checkpoint)
+{
+    writeMoves();
+
+    ostringstream data;
+    writeCheckpoint(data, checkpoint);
+
+    _os.put('K');
+    writeLittleEndian(_os, 4 + data.str().size(), 4);
+    writeLittleEndian(_os, clock.value, 4);
+    _os << data.str();
+
+    _clock = clock;
+    _actor = -1;
+}
+
+void ReplayWriter::move(Clock clock, int actor, Direction direction)
+{
+    auto gap = clock.value - _clock.value;
+
+    if(gap < 0 || (gap == 0 && actor <= _actor))
+    {
+        throw logic_error("moves recorded out of order");
+    }
+
+    appendVarint(_moves, gap);
+    appendVarint(_moves, (uint64_t)(gap == 0 ? actor - _actor - 1 : actor) << 2 | (int)direction);
+
+    _clock = clock;
+    _actor = actor;
+}
+
+void ReplayWriter::close()
+{
+    writeMoves();
+    _os.flush();
+}
+
+void ReplayWriter::writeMoves()
+{
+    if(_moves.empty())
+    {
+        return;
+    }
+
+    _os.put('M');
+    writeLittleEndian(_os, _moves.size(), 4);
+    _os << _moves;
+    _moves.clear();
+}
+
+ReplayReader::ReplayReader(const string& path) :
+    _file(path),
+    _keyframeEvery(0),
+    _pos(0),
+    _chunkEnd(0),
+    _clock(),
+    _actor(-1)
+{
+    auto data = _file.data();
+    auto size = _file.size();
+
+    if(size < HEADER_SIZE || memcmp(data, "LMRP", 4) != 0)
+    {
+        throw runtime_error("not a replay");
+    }
+
+    auto version = readLittleEndian(data + 4, 2);
+
+    if(version != REPLAY_VERSION)
+    {
+        throw runtime_error("unsupported replay version " + to_string(version));
+    }
+
+    _keyframeEvery = readLittleEndian(data + 6, 4);
+
+    // only keyframes need finding; moves are read from the one sought
+    for(auto pos = HEADER_SIZE; pos < size; )
+    {
+        if(size - pos < CHUNK_HEADER_SIZE)
+        {
+            throw runtime_error("truncated replay");
+        }
+
+        auto tag = data[pos];
+        auto chunkSize = readLittleEndian(data + pos + 1, 4);
+        auto begin = pos + CHUNK_HEADER_SIZE;
+
+        if(size - begin < chunkSize)
+        {
+            throw runtime_error("truncated replay");
+        }
+
+        if(tag == 'K')
+        {
+            if(chunkSize < 4)
+            {
+                throw runtime_error("bad replay");
+            }
+
+            auto clock = Clock {(int)readLittleEndian(data + begin, 4)};
+            _keyframes.push_back(Keyframe {clock, begin + 4, begin + chunkSize});
+        }
+        else if(tag != 'M')
+        {
+            throw runtime_error("bad replay");
+        }
+
+        pos = begin + chunkSize;
+    }
+
+    if(_keyframes.empty())
+    {
+        throw runtime_error("replay has no keyframes");
+    }
+}
+
+int ReplayReader::keyframeEvery() const
+{
+    return _keyframeEvery;
+}
+
+GameCheckpoint ReplayReader::seek(Clock clock)
+{
+    auto keyframe = _keyframes.begin();
+
+    // keyframes are in clock order
+    while(keyframe + 1 != _keyframes.end() && (keyframe + 1)->clock.value <= clock.value)
+    {
+        keyframe++;
+    }
+
+    auto checkpoint = readCheckpoint(_file.data() + keyframe->begin, keyframe->end - keyframe->begin);
+
+    _pos = keyframe->end;
+    _chunkEnd = keyframe->end;
+    _clock = keyframe->clock;
+    _actor = -1;
+
+    return checkpoint;
+}
+
+Direction ReplayReader::next(Clock clock, int actor)
+{
+    auto data = _file.data();
+
+    // on to the next chunk of moves; a keyframe starts them over
+    while(_pos == _chunkEnd)
+    {
+        if(_pos == _file.size())
+        {
+            throw runtime_error("replay ends before the game");
+        }
+
+        auto tag = data[_pos];
+        auto begin = _pos + CHUNK_HEADER_SIZE;
+        _chunkEnd = begin + readLittleEndian(data + _pos + 1, 4);
+
+        if(tag == 'K')
+        {
+            _clock = Clock {(int)readLittleEndian(data + begin, 4)};
+            _actor = -1;
+            _pos = _chunkEnd;
+        }
+        else
+        {
+            _pos = begin;
+        }
+    }
+
+    auto gap = readVarint();
+    auto code = readVarint();
+    auto moveActor = (int)(code >> 2) + (gap == 0 ? _actor + 1 : 0);
+
+    _clock = Clock {_clock.value + (int)gap};
+    _actor = moveActor;
+
+    if(_clock.value != clock.value || moveActor != actor)
+    {
+        throw runtime_error("replay does not match the game");
+    }
+
+    return (Direction)(code & 3);
+}
+
+uint64_t ReplayReader::readVarint()
+{
+    auto value = uint64_t {0};
+
+    for(auto shift = 0; shift < 64; shift += 7)
+    {
+        if(_pos == _chunkEnd)
+        {
+            throw runtime_error("truncated replay");
+        }
+
+        auto byte = (uint8_t)_file.data()[_pos++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+
+        if(byte < 0x80)
+        {
+            return value;
+        }
+    }
+
+    throw runtime_error("bad replay");
+}
@@ -0,0 +1,92 @@
+#ifndef LAMCO_REPLAY_HPP
+#define LAMCO_REPLAY_HPP
+
+#include "checkpoint.hpp"
+#include "mappedfile.hpp"
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const uint16_t REPLAY_VERSION = 1;
+
+// Who made a move: the player, or ghost n as n + 1
+static const int REPLAY_PLAYER = 0;
+
+// Records every move of a game, with a keyframe, a GameCheckpoint, every
+// keyframeEvery ticks. A replay file is a header and then chunks, each a
+// tag byte and a little-endian size:
+//
+//   'K': the clock the keyframe was taken before, then its checkpoint
+//   'M': the moves made since the keyframe before it
+//
+// Moves are varints: the ticks since the last move, then who moved, in
+// ascending order within a tick so only the gap from the last is
+// written, shifted left by 2 with the direction they moved in below.
+class ReplayWriter
+{
+public:
+    ReplayWriter(const string& path, int keyframeEvery);
+    ~ReplayWriter();
+
+    int keyframeEvery() const;
+    // The game as it is before any event due at or after clock
+    void keyframe(Clock clock, const GameCheckpoint& checkpoint);
+    void move(Clock clock, int actor, Direction direction);
+    // Writes out the moves since the last keyframe
+    void close();
+
+private:
+    ReplayWriter(const ReplayWriter&);
+    ReplayWriter& operator=(const ReplayWriter&);
+
+    void writeMoves();
+
+    ofstream _os;
+    int _keyframeEvery;
+    // moves since the last keyframe, encoded
+    string _moves;
+    Clock _clock;
+    int _actor;
+};
+
+// Plays a replay file back from any of its keyframes
+class ReplayReader
+{
+public:
+    explicit ReplayReader(const string& path);
+
+    int keyframeEvery() const;
+    // The last keyframe taken before clock, or the first; moves are read
+    // on from there
+    GameCheckpoint seek(Clock clock);
+    // The direction of the next move, which must be actor's on clock
+    Direction next(Clock clock, int actor);
+
+private:
+    ReplayReader(const ReplayReader&);
+    ReplayReader& operator=(const ReplayReader&);
+
+    struct Keyframe
+    {
+        Clock clock;
+        // the checkpoint, and the chunk after
+        size_t begin;
+        size_t end;
+    };
+
+    uint64_t readVarint();
+
+    MappedFile _file;
+    int _keyframeEvery;
+    vector<Keyframe> _keyframes;
+
+    // the chunk being read and where in it
+    size_t _pos;
+    size_t _chunkEnd;
+    Clock _clock;
+    int _actor;
+};
+
+#endif
@@ -0,0 +1,730 @@
+#include "shard.hpp"
+#include <cerrno>
+#include <chrono>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// a failed worker waits this long for each failure so far before reconnecting
+static const auto RETRY_DELAY = chrono::seconds(1);
+// a worker playing a shard says something at least this often, well
+// within the shortest timeout a coordinator can set
+static const auto HEARTBEAT = chrono::milliseconds(250);
+
+// A TCP connection read and written a line at a time
+class LineSocket
+{
+public:
+    explicit LineSocket(int fd);
+    ~LineSocket();
+
+    // A connection to host:port
+    static int connectTo(const string& address);
+
+    void write(const string& str);
+    // Returns false at the end of the stream. timeout: seconds, or 0 forever
+    bool readLine(string& line, int timeout);
+    // Whether the peer has closed the connection, without waiting
+    bool closed();
+
+private:
+    LineSocket(const LineSocket&);
+    LineSocket& operator=(const LineSocket&);
+
+    int _fd;
+    string _buffer;
+};
+
+LineSocket::LineSocket(int fd) :
+    _fd(fd)
+{
+}
+
+LineSocket::~LineSocket()
+{
+    close(_fd);
+}
+
+int LineSocket::connectTo(const string& address)
+{
+    auto colon = address.rfind(':');
+
+    if(colon == string::npos || colon == 0 || colon + 1 == address.size())
+    {
+        throw runtime_error("worker address must be host:port");
+    }
+
+    auto host = address.substr(0, colon);
+    auto port = address.substr(colon + 1);
+
+    // [::1]:port
+    if(host.size() > 2 && host.front() == '[' && host.back() == ']')
+    {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found;
+
+    if(getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+    {
+        throw runtime_error("unknown worker " + address);
+    }
+
+    auto fd = -1;
+
+    for(auto info = found; info && fd < 0; info = info->ai_next)
+    {
+        fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+
+        if(fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) != 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    freeaddrinfo(found);
+
+    if(fd < 0)
+    {
+        throw runtime_error("cannot connect to worker " + address);
+    }
+
+    return fd;
+}
+
+void LineSocket::write(const string& str)
+{
+    auto sent = size_t {0};
+
+    while(sent < str.size())
+    {
+        // a closed peer is an error here, not a SIGPIPE
+        auto n = send(_fd, str.data() + sent, str.size() - sent, MSG_NOSIGNAL);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            throw runtime_error("connection lost");
+        }
+
+        sent += n;
+    }
+}
+
+bool LineSocket::readLine(string& line, int timeout)
+{
+    while(true)
+    {
+        auto end = _buffer.find('\n');
+
+        if(end != string::npos)
+        {
+            line = _buffer.substr(0, end);
+            _buffer.erase(0, end + 1);
+            return true;
+        }
+
+        if(timeout > 0)
+        {
+            pollfd readable = {_fd, POLLIN, 0};
+            auto ready = poll(&readable, 1, timeout * 1000);
+
+            if(ready == 0)
+            {
+                throw runtime_error("timed out");
+            }
+
+            if(ready < 0)
+            {
+                if(errno == EINTR)
+                {
+                    continue;
+                }
+
+                throw runtime_error("connection lost");
+            }
+        }
+
+        char chunk[4096];
+        auto n = recv(_fd, chunk, sizeof(chunk), 0);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            throw runtime_error("connection lost");
+        }
+
+        if(n == 0)
+        {
+            if(!_buffer.empty())
+            {
+                throw runtime_error("connection lost");
+            }
+
+            return false;
+        }
+
+        _buffer.append(chunk, n);
+    }
+}
+
+bool LineSocket::closed()
+{
+    pollfd readable = {_fd, POLLIN, 0};
+
+    if(poll(&readable, 1, 0) <= 0)
+    {
+        return false;
+    }
+
+    char byte;
+    auto n = recv(_fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    return n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+}
+
+static vector<string> splitTabs(const string& line)
+{
+    vector<string> fields;
+    auto start = size_t {0};
+
+    while(true)
+    {
+        auto end = line.find('\t', start);
+        fields.push_back(line.substr(start, end - start));
+
+        if(end == string::npos)
+        {
+            return fields;
+        }
+
+        start = end + 1;
+    }
+}
+
+// Paths travel as tab-separated fields of one line
+static const string& checkedPath(const string& path)
+{
+    if(path.find_first_of("\t\n") != string::npos)
+    {
+        throw runtime_error("path holds a tab or newline: " + path);
+    }
+
+    return path;
+}
+
+static string oneLine(string str)
+{
+    for(auto& c : str)
+    {
+        c = c == '\t' || c == '\n' || c == '\r' ? ' ' : c;
+    }
+
+    return str;
+}
+
+static string resultLine(int index, const TournamentResult& result)
+{
+    ostringstream line;
+    line << "result " << index << ' ' << result.game.score << ' ' << result.game.lives
+         << ' ' << result.game.ticks << ' ' << result.game.pillsLeft << ' ' << (int)result.game.end
+         << ' ' << fixed << setprecision(6) << result.seconds << '\t' << oneLine(result.error) << '\n';
+
+    return line.str();
+}
+
+static string greeting()
+{
+    return "lamco-tournament " + to_string(SHARD_PROTOCOL_VERSION);
+}
+
+struct ShardJob
+{
+    int index;
+    string mapPath;
+    string playerPath;
+    vector<string> ghostPaths;
+};
+
+static ShardJob parseJob(const string& line)
+{
+    auto fields = splitTabs(line);
+    auto job = ShardJob();
+    istringstream head(fields[0]);
+    string word;
+    head >> word >> job.index;
+
+    if(!head || word != "job" || job.index < 0 || fields.size() < 4)
+    {
+        throw runtime_error("bad job");
+    }
+
+    job.mapPath = fields[1];
+    job.playerPath = fields[2];
+    job.ghostPaths.assign(fields.begin() + 3, fields.end());
+
+    return job;
+}
+
+// Returns the job index of a result line
+static int parseResult(const string& line, TournamentResult& result)
+{
+    auto tab = line.find('\t');
+
+    if(tab == string::npos)
+    {
+        throw runtime_error("bad result");
+    }
+
+    istringstream fields(line.substr(0, tab));
+    string word;
+    auto index = -1;
+    auto end = -1;
+    fields >> word >> index >> result.game.score >> result.game.lives >> result.game.ticks
+           >> result.game.pillsLeft >> end >> result.seconds;
+
+    if(!fields || word != "result" || end < (int)GameEnd::RUNNING || end > (int)GameEnd::TIMEOUT)
+    {
+        throw runtime_error("bad result");
+    }
+
+    result.game.end = (GameEnd)end;
+    result.error = line.substr(tab + 1);
+
+    return index;
+}
+
+ShardWorker::ShardWorker(int port, WorkerPool& pool) :
+    _listener(socket(AF_INET, SOCK_STREAM, 0)),
+    _port(port),
+    _pool(pool)
+{
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    socklen_t size = sizeof(address);
+    auto reuse = 1;
+
+    if(_listener < 0 ||
+        setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(_listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+        listen(_listener, 16) != 0 ||
+        getsockname(_listener, (sockaddr*)&address, &size) != 0)
+    {
+        if(_listener >= 0)
+        {
+            close(_listener);
+        }
+
+        throw runtime_error("cannot listen on port " + to_string(port));
+    }
+
+    _port = ntohs(address.sin_port);
+}
+
+ShardWorker::~ShardWorker()
+{
+    close(_listener);
+}
+
+int ShardWorker::port() const
+{
+    return _port;
+}
+
+void ShardWorker::serve()
+{
+    while(true)
+    {
+        auto fd = accept(_listener, nullptr, nullptr);
+
+        if(fd < 0)
+        {
+            if(errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+
+            throw runtime_error("cannot accept coordinators");
+        }
+
+        try
+        {
+            serveConnection(fd);
+        }
+        catch(const runtime_error& e)
+        {
+            cerr << "coordinator dropped: " << e.what() << endl;
+        }
+    }
+}
+
+void ShardWorker::serveConnection(int fd)
+{
+    LineSocket socket(fd);
+    socket.write(greeting() + "\n");
+    string line;
+
+    while(socket.readLine(line, 0))
+    {
+        istringstream header(line);
+        string word;
+        auto count = 0;
+        auto engine = -1;
+        header >> word >> count >> engine;
+
+        if(!header || word != "shard" || count < 1 ||
+            engine < (int)GhcEngine::INTERPRETER || engine > (int)GhcEngine::DIFFERENTIAL)
+        {
+            throw runtime_error("bad shard");
+        }
+
+        vector<ShardJob> jobs;
+
+        for(auto i = 0; i < count; i++)
+        {
+            if(!socket.readLine(line, 0))
+            {
+                throw runtime_error("truncated shard");
+            }
+
+            jobs.push_back(parseJob(line));
+        }
+
+        // games report to this thread as they finish, and it passes their
+        // results on, or a heartbeat if there are none, so the coordinator
+        // hears from us while long games play; it cancels the rest of the
+        // shard if the coordinator goes away
+        mutex lock;
+        condition_variable reported;
+        string pending;
+        auto played = false;
+        atomic<bool> cancelled(false);
+
+        thread play([&]
+        {
+            _pool.forEach(count, [&](int i)
+            {
+                auto result = playGame(jobs[i].mapPath, jobs[i].playerPath, jobs[i].ghostPaths,
+                    (GhcEngine)engine, &cancelled);
+
+                lock_guard<mutex> hold(lock);
+                pending += resultLine(jobs[i].index, result);
+                reported.notify_one();
+            });
+
+            lock_guard<mutex> hold(lock);
+            played = true;
+            reported.notify_one();
+        });
+
+        try
+        {
+            unique_lock<mutex> hold(lock);
+
+            while(true)
+            {
+                reported.wait_for(hold, HEARTBEAT, [&] { return !pending.empty() || played; });
+
+                if(played && pending.empty())
+                {
+                    break;
+                }
+
+                auto reply = pending.empty() ? string("alive\n") : pending;
+                pending.clear();
+                hold.unlock();
+
+                if(socket.closed())
+                {
+                    throw runtime_error("connection lost");
+                }
+
+                socket.write(reply);
+                hold.lock();
+            }
+        }
+        catch(...)
+        {
+            cancelled = true;
+            play.join();
+            throw;
+        }
+
+        play.join();
+    }
+}
+
+// A run of consecutive jobs and the message that sends them
+struct Shard
+{
+    int first;
+    int count;
+    string message;
+};
+
+// Shards waiting for a worker, shared by the coordinator's threads
+class ShardQueue
+{
+public:
+    explicit ShardQueue(int shards) :
+        _inFlight(0)
+    {
+        for(auto i = 0; i < shards; i++)
+        {
+            _pending.push_back(i);
+        }
+    }
+
+    // The next shard to send, waiting while others may yet be given back,
+    // or -1 once none are left
+    int take()
+    {
+        unique_lock<mutex> hold(_lock);
+        _changed.wait(hold, [this] { return !_pending.empty() || _inFlight == 0; });
+
+        if(_pending.empty())
+        {
+            return -1;
+        }
+
+        auto shard = _pending.front();
+        _pending.pop_front();
+        _inFlight++;
+
+        return shard;
+    }
+
+    void finish()
+    {
+        lock_guard<mutex> hold(_lock);
+        _inFlight--;
+        _changed.notify_all();
+    }
+
+    void giveBack(int shard)
+    {
+        lock_guard<mutex> hold(_lock);
+        _pending.push_front(shard);
+        _inFlight--;
+        _changed.notify_all();
+    }
+
+    bool empty()
+    {
+        lock_guard<mutex> hold(_lock);
+        return _pending.empty();
+    }
+
+private:
+    mutex _lock;
+    condition_variable _changed;
+    deque<int> _pending;
+    int _inFlight;
+};
+
+// Sends shards to one worker until none are left or it has failed too
+// often, returning how many it failed after they were sent
+static int driveWorker(const string& address,
+    ShardQueue& queue,
+    const vector<Shard>& shards,
+    vector<TournamentResult>& results,
+    int retries,
+    int timeout)
+{
+    unique_ptr<LineSocket> socket;
+    auto failures = 0;
+    auto resent = 0;
+
+    while(true)
+    {
+        auto shardNum = queue.take();
+
+        if(shardNum < 0)
+        {
+            return resent;
+        }
+
+        auto& shard = shards[shardNum];
+        auto sent = false;
+
+        try
+        {
+            string line;
+
+            if(!socket)
+            {
+                socket.reset(new LineSocket(LineSocket::connectTo(address)));
+
+                if(!socket->readLine(line, timeout) || line != greeting())
+                {
+                    throw runtime_error("not a lamco-tournament worker");
+                }
+            }
+
+            socket->write(shard.message);
+            sent = true;
+
+            vector<TournamentResult> received(shard.count);
+            vector<bool> seen(shard.count);
+
+            // the timeout is how long the worker may go quiet: it sends
+            // heartbeats between results
+            for(auto i = 0; i < shard.count;)
+            {
+                if(!socket->readLine(line, timeout))
+                {
+                    throw runtime_error("connection lost");
+                }
+
+                if(line == "alive")
+                {
+                    continue;
+                }
+
+                auto result = TournamentResult();
+                auto offset = parseResult(line, result) - shard.first;
+
+                if(offset < 0 || offset >= shard.count || seen[offset])
+                {
+                    throw runtime_error("bad result");
+                }
+
+                received[offset] = result;
+                seen[offset] = true;
+                i++;
+            }
+
+            // only this thread holds the shard, so its slots are ours
+            for(auto i = 0; i < shard.count; i++)
+            {
+                results[shard.first + i] = received[i];
+            }
+
+            queue.finish();
+        }
+        catch(const runtime_error& e)
+        {
+            socket.reset();
+            queue.giveBack(shardNum);
+            resent += sent ? 1 : 0;
+            failures++;
+
+            cerr << "worker " << address << " failed: " << e.what() << endl;
+
+            if(failures > retries)
+            {
+                cerr << "worker " << address << " given up on" << endl;
+                return resent;
+            }
+
+            this_thread::sleep_for(RETRY_DELAY * failures);
+        }
+    }
+}
+
+ShardCoordinator::ShardCoordinator(const vector<string>& workers, int shardSize, int retries, int timeout) :
+    _workers(workers),
+    _shardSize(shardSize),
+    _retries(retries),
+    _timeout(timeout),
+    _shards(0),
+    _resent(0)
+{
+    if(_workers.empty())
+    {
+        throw runtime_error("a coordinator needs workers");
+    }
+}
+
+void ShardCoordinator::run(const Tournament& tournament, vector<TournamentResult>& results)
+{
+    auto& jobs = tournament.jobs();
+    auto jobCount = (int)jobs.size();
+    auto shardSize = _shardSize > 0 ? _shardSize : max(1, jobCount / ((int)_workers.size() * 4));
+    vector<Shard> shards;
+
+    for(auto first = 0; first < jobCount; first += shardSize)
+    {
+        auto count = min(shardSize, jobCount - first);
+        ostringstream message;
+        message << "shard " << count << ' ' << (int)tournament.engine() << '\n';
+
+        for(auto i = first; i < first + count; i++)
+        {
+            auto& job = jobs[i];
+            message << "job " << i << '\t' << checkedPath(tournament.maps()[job.map])
+                    << '\t' << checkedPath(tournament.players()[job.player]);
+
+            for(auto& path : tournament.ghostSets()[job.ghosts])
+            {
+                message << '\t' << checkedPath(path);
+            }
+
+            message << '\n';
+        }
+
+        shards.push_back(Shard {first, count, message.str()});
+    }
+
+    _shards = shards.size();
+    _resent = 0;
+
+    ShardQueue queue(_shards);
+    vector<int> resent(_workers.size());
+    vector<thread> threads;
+
+    for(auto i = 0u; i < _workers.size(); i++)
+    {
+        threads.push_back(thread([&, i]
+        {
+            resent[i] = driveWorker(_workers[i], queue, shards, results, _retries, _timeout);
+        }));
+    }
+
+    for(auto i = 0u; i < threads.size(); i++)
+    {
+        threads[i].join();
+        _resent += resent[i];
+    }
+
+    if(!queue.empty())
+    {
+        throw runtime_error("every worker failed");
+    }
+}
+
+int ShardCoordinator::shards() const
+{
+    return _shards;
+}
+
+int ShardCoordinator::resent() const
+{
+    return _resent;
+}
@@ -0,0 +1,83 @@
+#ifndef LAMCO_SHARD_HPP
+#define LAMCO_SHARD_HPP
+
+#include "tournament.hpp"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Tournaments split across lamco-tournament processes over TCP. Each
+// message is one line, so paths may not hold tabs or newlines:
+//
+//   worker:      lamco-tournament <SHARD_PROTOCOL_VERSION>
+//   coordinator: shard <jobs> <engine>
+//   coordinator: job <index>\t<map>\t<player>\t<ghost>[\t<ghost>...]
+//   worker:      result <index> <score> <lives> <ticks> <pills> <end> <seconds>\t<error>
+//   worker:      alive
+//
+// A job line follows the shard line once per job; the worker answers each
+// with a result line as soon as that game is played, in any order, and
+// says alive whenever it has had nothing to say for a moment, so a
+// coordinator can tell a slow shard from a dead worker. Paths are opened
+// on the worker, so its files must be where the coordinator's are.
+const int SHARD_PROTOCOL_VERSION = 2;
+
+// Plays shards for coordinators, one connection at a time. A coordinator
+// that goes away mid-shard cancels the games left, so the next one
+// connecting soon gets a turn.
+class ShardWorker
+{
+public:
+    // port 0 picks a free one
+    ShardWorker(int port, WorkerPool& pool);
+    ~ShardWorker();
+
+    int port() const;
+    // Serves until killed
+    void serve();
+
+private:
+    ShardWorker(const ShardWorker&);
+    ShardWorker& operator=(const ShardWorker&);
+
+    void serveConnection(int fd);
+
+    int _listener;
+    int _port;
+    WorkerPool& _pool;
+};
+
+// Splits a tournament into shards of consecutive jobs and plays them on
+// workers. A shard a worker fails to finish goes back to be sent again,
+// so every job is played once whatever fails, and each lands in its own
+// slot, so the merged results come out in job order.
+class ShardCoordinator
+{
+public:
+    // workers: host:port of each
+    // shardSize: jobs per shard, or 0 to give each worker about four
+    // retries: times a worker may fail before it is given up on
+    // timeout: seconds a worker may go quiet, or 0 forever
+    ShardCoordinator(const vector<string>& workers, int shardSize, int retries, int timeout);
+
+    // Fills results, which has a slot per job
+    void run(const Tournament& tournament, vector<TournamentResult>& results);
+
+    int shards() const;
+    // shards sent again after a worker failed them
+    int resent() const;
+
+private:
+    ShardCoordinator(const ShardCoordinator&);
+    ShardCoordinator& operator=(const ShardCoordinator&);
+
+    vector<string> _workers;
+    int _shardSize;
+    int _retries;
+    int _timeout;
+    int _shards;
+    int _resent;
+};
+
+#endif
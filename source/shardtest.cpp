@@ -0,0 +1,119 @@
+#include "shard.hpp"
+#include "tournament.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace std;
+
+// the coordinator's timeout, well under how long each game takes
+static const int TIMEOUT = 1;
+static const int GAMES = 4;
+
+// A map where nothing can catch the player, so the game runs until the
+// end of lives clock, with ghosts that use up every step they are given
+static void writeLongGame(const string& mapPath, const string& ghostPath)
+{
+    const int width = 120;
+    const int height = 40;
+    vector<string> rows(height, string(width, '#'));
+    rows[1][1] = '\\';
+    rows[1][3] = '%';
+    rows[1][5] = '.';
+
+    for(auto x = 7; x < 15; x += 2)
+    {
+        rows[1][x] = '=';
+        rows[2][x] = ' ';
+    }
+
+    ofstream map(mapPath);
+
+    for(auto& row : rows)
+    {
+        map << row << '\n';
+    }
+
+    ofstream ghost(ghostPath);
+    ghost << "add [c],b\nxor c,[c]\ninc b\njeq 0,0,0\n";
+
+    if(!map || !ghost)
+    {
+        throw runtime_error("bad output stream");
+    }
+}
+
+// Plays games that each take longer than the coordinator's timeout on two
+// loopback workers. Heartbeats have to keep every shard alive, so nothing
+// may be resent.
+int main()
+{
+    char directory[] = "/tmp/shardtest.XXXXXX";
+
+    if(!mkdtemp(directory))
+    {
+        cerr << "An error occurred: cannot make a temporary directory" << endl;
+        return EXIT_FAILURE;
+    }
+
+    auto mapPath = string(directory) + "/long.txt";
+    auto ghostPath = string(directory) + "/busy.ghc";
+    auto passed = false;
+
+    try
+    {
+        writeLongGame(mapPath, ghostPath);
+
+        // the workers serve until the process exits
+        vector<string> addresses;
+
+        for(auto i = 0; i < 2; i++)
+        {
+            auto pool = new WorkerPool(1);
+            auto worker = new ShardWorker(0, *pool);
+            addresses.push_back("127.0.0.1:" + to_string(worker->port()));
+            thread([worker] { worker->serve(); }).detach();
+        }
+
+        Tournament tournament({mapPath}, {"none"}, vector<vector<string>>(GAMES, {ghostPath}));
+        ShardCoordinator coordinator(addresses, 2, 0, TIMEOUT);
+        tournament.run(coordinator);
+
+        for(auto& result : tournament.results())
+        {
+            if(!result.error.empty())
+            {
+                throw runtime_error("game failed: " + result.error);
+            }
+
+            if(result.game.end != GameEnd::TIMEOUT || result.seconds <= TIMEOUT)
+            {
+                throw runtime_error("game too short to outlast the timeout");
+            }
+        }
+
+        if(coordinator.resent() != 0)
+        {
+            throw runtime_error("shards were resent");
+        }
+
+        cout << GAMES << " games of up to " << tournament.results().back().seconds
+             << "s each with a " << TIMEOUT << "s timeout, none resent" << endl;
+        passed = true;
+    }
+    catch(const runtime_error& e)
+    {
+        cerr << "An error occurred: " << e.what() << endl;
+    }
+
+    remove(mapPath.c_str());
+    remove(ghostPath.c_str());
+    rmdir(directory);
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,241 @@
+#include "tournament.hpp"
+#include "shard.hpp"
+#include <chrono>
+#include <iomanip>
+#include <memory>
+#include <stdexcept>
+
+// ticks a cancellable game plays between looks at whether it was cancelled
+static const int CANCEL_TICKS = 100000;
+
+static string joinPaths(const vector<string>& paths)
+{
+    auto joined = string {};
+
+    for(auto& path : paths)
+    {
+        joined += joined.empty() ? "" : ",";
+        joined += path;
+    }
+
+    return joined;
+}
+
+static string csvField(const string& str)
+{
+    if(str.find_first_of(",\"\n") == string::npos)
+    {
+        return str;
+    }
+
+    auto quoted = string {"\""};
+
+    for(auto c : str)
+    {
+        quoted += c == '"' ? "\"\"" : string(1, c);
+    }
+
+    return quoted + "\"";
+}
+
+static string jsonString(const string& str)
+{
+    auto quoted = string {"\""};
+
+    for(auto c : str)
+    {
+        switch(c)
+        {
+            case '"': quoted += "\\\""; break;
+            case '\\': quoted += "\\\\"; break;
+            case '\n': quoted += "\\n"; break;
+            case '\t': quoted += "\\t"; break;
+            default:
+                if((unsigned char)c < 0x20)
+                {
+                    static const char digits[] = "0123456789abcdef";
+                    quoted += "\\u00";
+                    quoted += digits[c >> 4];
+                    quoted += digits[c & 0xF];
+                }
+                else
+                {
+                    quoted += c;
+                }
+                break;
+        }
+    }
+
+    return quoted + "\"";
+}
+
+TournamentResult playGame(const string& mapPath,
+    const string& playerPath,
+    const vector<string>& ghostPaths,
+    GhcEngine engine,
+    const atomic<bool>* cancelled)
+{
+    auto result = TournamentResult();
+    auto start = chrono::steady_clock::now();
+
+    try
+    {
+        // far too big for a worker's stack
+        unique_ptr<Game> game(new Game());
+        game->init(mapPath, playerPath, ghostPaths, engine);
+        game->setHeadless(0, false);
+
+        if(cancelled)
+        {
+            // runUntil picks up exactly where it paused, so slicing the
+            // game only decides how often cancelled is looked at
+            auto until = 0;
+
+            do
+            {
+                if(*cancelled)
+                {
+                    throw runtime_error("cancelled");
+                }
+
+                until += CANCEL_TICKS;
+            }
+            while(game->runUntil(Clock {until}));
+        }
+        else
+        {
+            game->run();
+        }
+
+        result.game = game->result();
+    }
+    catch(const exception& e)
+    {
+        result.error = e.what();
+    }
+    catch(...)
+    {
+        result.error = "unknown error";
+    }
+
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return result;
+}
+
+Tournament::Tournament(const vector<string>& maps,
+    const vector<string>& players,
+    const vector<vector<string>>& ghostSets,
+    GhcEngine engine) :
+    _maps(maps),
+    _players(players),
+    _ghostSets(ghostSets),
+    _engine(engine)
+{
+    for(auto map = 0; map < (int)_maps.size(); map++)
+    {
+        for(auto player = 0; player < (int)_players.size(); player++)
+        {
+            for(auto ghosts = 0; ghosts < (int)_ghostSets.size(); ghosts++)
+            {
+                _jobs.push_back(TournamentJob {map, player, ghosts});
+            }
+        }
+    }
+}
+
+const vector<string>& Tournament::maps() const
+{
+    return _maps;
+}
+
+const vector<string>& Tournament::players() const
+{
+    return _players;
+}
+
+const vector<vector<string>>& Tournament::ghostSets() const
+{
+    return _ghostSets;
+}
+
+GhcEngine Tournament::engine() const
+{
+    return _engine;
+}
+
+const vector<TournamentJob>& Tournament::jobs() const
+{
+    return _jobs;
+}
+
+void Tournament::run(WorkerPool& pool)
+{
+    _results.assign(_jobs.size(), TournamentResult());
+
+    pool.forEach((int)_jobs.size(), [this](int jobNum)
+    {
+        auto& job = _jobs[jobNum];
+        _results[jobNum] = playGame(_maps[job.map], _players[job.player], _ghostSets[job.ghosts], _engine);
+    });
+}
+
+void Tournament::run(ShardCoordinator& coordinator)
+{
+    _results.assign(_jobs.size(), TournamentResult());
+    coordinator.run(*this, _results);
+}
+
+const vector<TournamentResult>& Tournament::results() const
+{
+    return _results;
+}
+
+void Tournament::writeCsv(ostream& os) const
+{
+    os << "map,player,ghosts,score,lives,ticks,pills,end,seconds,error\n";
+
+    for(auto i = 0u; i < _results.size(); i++)
+    {
+        auto& job = _jobs[i];
+        auto& result = _results[i];
+
+        os << csvField(_maps[job.map]) << ',' << csvField(_players[job.player]) << ','
+           << csvField(joinPaths(_ghostSets[job.ghosts])) << ','
+           << result.game.score << ',' << result.game.lives << ',' << result.game.ticks << ','
+           << result.game.pillsLeft << ',' << gameEndName(result.game.end) << ','
+           << fixed << setprecision(6) << result.seconds << defaultfloat << ','
+           << csvField(result.error) << '\n';
+    }
+}
+
+void Tournament::writeJsonl(ostream& os) const
+{
+    for(auto i = 0u; i < _results.size(); i++)
+    {
+        auto& job = _jobs[i];
+        auto& result = _results[i];
+
+        os << "{\"map\":" << jsonString(_maps[job.map])
+           << ",\"player\":" << jsonString(_players[job.player])
+           << ",\"ghosts\":[";
+
+        for(auto& path : _ghostSets[job.ghosts])
+        {
+            os << (&path == &_ghostSets[job.ghosts].front() ? "" : ",") << jsonString(path);
+        }
+
+        os << "],\"score\":" << result.game.score
+           << ",\"lives\":" << result.game.lives
+           << ",\"ticks\":" << result.game.ticks
+           << ",\"pills\":" << result.game.pillsLeft
+           << ",\"end\":" << jsonString(gameEndName(result.game.end))
+           << ",\"seconds\":" << fixed << setprecision(6) << result.seconds << defaultfloat;
+
+        if(!result.error.empty())
+        {
+            os << ",\"error\":" << jsonString(result.error);
+        }
+
+        os << "}\n";
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef LAMCO_TOURNAMENT_HPP
+#define LAMCO_TOURNAMENT_HPP
+
+#include "game.hpp"
+#include "workerpool.hpp"
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class ShardCoordinator;
+
+// One game: indexes into the tournament's maps, players and ghost sets
+struct TournamentJob
+{
+    int map;
+    int player;
+    int ghosts;
+};
+
+struct TournamentResult
+{
+    GameResult game;
+    // wall time the game took
+    double seconds;
+    // what stopped the game, if it failed
+    string error;
+};
+
+// Plays one game headless, catching what stops it. Safe on a worker.
+// Once cancelled, if given, turns true, the game stops soon after with
+// an error.
+TournamentResult playGame(const string& mapPath,
+    const string& playerPath,
+    const vector<string>& ghostPaths,
+    GhcEngine engine,
+    const atomic<bool>* cancelled = nullptr);
+
+// Every combination of map, player and ghost set, played headless
+class Tournament
+{
+public:
+    // Each ghost set is a list of ghost program paths, dealt out to the
+    // ghosts of a map as lamco --ghost does
+    Tournament(const vector<string>& maps,
+        const vector<string>& players,
+        const vector<vector<string>>& ghostSets,
+        GhcEngine engine = GhcEngine::INTERPRETER);
+
+    const vector<string>& maps() const;
+    const vector<string>& players() const;
+    const vector<vector<string>>& ghostSets() const;
+    GhcEngine engine() const;
+    const vector<TournamentJob>& jobs() const;
+
+    // Plays every job across pool. Each game writes only its own result,
+    // so nothing is locked.
+    void run(WorkerPool& pool);
+    // Plays every job on the coordinator's workers instead
+    void run(ShardCoordinator& coordinator);
+    const vector<TournamentResult>& results() const;
+
+    // One row or line per job, in job order
+    void writeCsv(ostream& os) const;
+    void writeJsonl(ostream& os) const;
+
+private:
+    vector<string> _maps;
+    vector<string> _players;
+    vector<vector<string>> _ghostSets;
+    GhcEngine _engine;
+    vector<TournamentJob> _jobs;
+    vector<TournamentResult> _results;
+};
+
+#endif
@@ -0,0 +1,163 @@
+#include "trace.hpp"
+#include "endian.hpp"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+static const size_t HEADER_SIZE = 8;
+static const size_t RECORD_SIZE = 16;
+
+static const auto IDLE_WAIT = chrono::milliseconds(1);
+
+static void writeRecord(ostream& os, const GhcTraceRecord& record)
+{
+    writeLittleEndian(os, (uint32_t)record.clock, 4);
+    writeLittleEndian(os, record.ghostNum, 2);
+    os.put((char)record.pc);
+    os.write((const char*)record.registers, sizeof(record.registers));
+    os.put((char)record.reserved);
+}
+
+GhcTraceBuffer::GhcTraceBuffer() :
+    _head(0),
+    _tail(0)
+{
+}
+
+void GhcTraceBuffer::push(const GhcTraceRecord& record)
+{
+    auto head = _head.load(memory_order_relaxed);
+
+    while(head - _tail.load(memory_order_acquire) == CAPACITY)
+    {
+        this_thread::yield();
+    }
+
+    _records[head % CAPACITY] = record;
+    _head.store(head + 1, memory_order_release);
+}
+
+size_t GhcTraceBuffer::drain(ostream& os)
+{
+    auto tail = _tail.load(memory_order_relaxed);
+    auto head = _head.load(memory_order_acquire);
+
+    for(auto pos = tail; pos != head; pos++)
+    {
+        writeRecord(os, _records[pos % CAPACITY]);
+    }
+
+    _tail.store(head, memory_order_release);
+    return head - tail;
+}
+
+GhcTraceWriter::GhcTraceWriter(const string& path, int ghostCount) :
+    _os(path, ios::binary),
+    _stopping(false)
+{
+    if(!_os)
+    {
+        throw runtime_error("bad trace stream");
+    }
+
+    _os.write("GHCT", 4);
+    writeLittleEndian(_os, GHC_TRACE_VERSION, 2);
+    writeLittleEndian(_os, RECORD_SIZE, 2);
+
+    for(auto i = 0; i < ghostCount; i++)
+    {
+        _buffers.emplace_back(new GhcTraceBuffer());
+    }
+
+    _thread = thread(&GhcTraceWriter::run, this);
+}
+
+GhcTraceWriter::~GhcTraceWriter()
+{
+    close();
+}
+
+GhcTraceBuffer& GhcTraceWriter::buffer(int ghostNum)
+{
+    return *_buffers[ghostNum];
+}
+
+void GhcTraceWriter::close()
+{
+    if(!_thread.joinable())
+    {
+        return;
+    }
+
+    _stopping.store(true);
+    _thread.join();
+    _os.flush();
+}
+
+size_t GhcTraceWriter::drain()
+{
+    auto count = size_t {0};
+
+    for(auto& buffer : _buffers)
+    {
+        count += buffer->drain(_os);
+    }
+
+    return count;
+}
+
+void GhcTraceWriter::run()
+{
+    while(!_stopping.load())
+    {
+        if(drain() == 0)
+        {
+            this_thread::sleep_for(IDLE_WAIT);
+        }
+    }
+
+    // producers are done by the time close() is called
+    drain();
+}
+
+void readTraceHeader(istream& is)
+{
+    char data[HEADER_SIZE];
+
+    if(!is.read(data, sizeof(data)) || memcmp(data, "GHCT", 4) != 0)
+    {
+        throw runtime_error("not a ghost trace");
+    }
+
+    auto header = GhcTraceHeader {};
+    memcpy(header.magic, data, 4);
+    header.version = readLittleEndian(data + 4, 2);
+    header.recordSize = readLittleEndian(data + 6, 2);
+
+    if(header.version != GHC_TRACE_VERSION || header.recordSize != RECORD_SIZE)
+    {
+        throw runtime_error("unsupported ghost trace version " + to_string(header.version));
+    }
+}
+
+bool readTraceRecord(istream& is, GhcTraceRecord& record)
+{
+    char data[RECORD_SIZE];
+
+    if(is.read(data, sizeof(data)))
+    {
+        record.clock = (int32_t)readLittleEndian(data, 4);
+        record.ghostNum = readLittleEndian(data + 4, 2);
+        record.pc = data[6];
+        memcpy(record.registers, data + 7, sizeof(record.registers));
+        record.reserved = data[15];
+        return true;
+    }
+
+    if(is.gcount() != 0)
+    {
+        throw runtime_error("truncated ghost trace");
+    }
+
+    return false;
+}
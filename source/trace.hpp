@@ -0,0 +1,88 @@
+#ifndef LAMCO_TRACE_HPP
+#define LAMCO_TRACE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// One int 8 call. Trace files are a GhcTraceHeader followed by these,
+// field by field in little endian, 16 bytes a record.
+struct GhcTraceRecord
+{
+    int32_t clock;
+    uint16_t ghostNum;
+    uint8_t pc;
+    // A-H
+    uint8_t registers[8];
+    uint8_t reserved;
+};
+
+struct GhcTraceHeader
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t recordSize;
+};
+
+static const uint16_t GHC_TRACE_VERSION = 1;
+
+// Single-producer single-consumer ring of trace records for one ghost:
+// the thread stepping the ghost pushes, the writer thread drains
+class GhcTraceBuffer
+{
+public:
+    GhcTraceBuffer();
+
+    // Waits for the writer when the ring is full rather than lose records
+    void push(const GhcTraceRecord& record);
+    // Writes out everything pushed so far, returning the number of records
+    size_t drain(ostream& os);
+
+private:
+    static const uint64_t CAPACITY = 1024;
+
+    GhcTraceBuffer(const GhcTraceBuffer&);
+    GhcTraceBuffer& operator=(const GhcTraceBuffer&);
+
+    GhcTraceRecord _records[CAPACITY];
+    // total records pushed and drained; only the owning side writes each
+    atomic<uint64_t> _head;
+    atomic<uint64_t> _tail;
+};
+
+// Owns one buffer per ghost and a background thread appending them to a
+// trace file. Records of one ghost stay in order; ghosts interleave.
+class GhcTraceWriter
+{
+public:
+    GhcTraceWriter(const string& path, int ghostCount);
+    ~GhcTraceWriter();
+
+    GhcTraceBuffer& buffer(int ghostNum);
+    // Stops the writer once everything pushed has been written
+    void close();
+
+private:
+    GhcTraceWriter(const GhcTraceWriter&);
+    GhcTraceWriter& operator=(const GhcTraceWriter&);
+
+    size_t drain();
+    void run();
+
+    ofstream _os;
+    vector<unique_ptr<GhcTraceBuffer>> _buffers;
+    atomic<bool> _stopping;
+    thread _thread;
+};
+
+// Readers for trace files; records come back in file order
+void readTraceHeader(istream& is);
+bool readTraceRecord(istream& is, GhcTraceRecord& record);
+
+#endif
@@ -0,0 +1,107 @@
+#include "workerpool.hpp"
+
+WorkerPool::WorkerPool(int threads) :
+    _task(nullptr),
+    _count(0),
+    _generation(0),
+    _finished(0),
+    _stopping(false),
+    _next(0)
+{
+    for(auto i = 1; i < threads; i++)
+    {
+        _threads.emplace_back(&WorkerPool::work, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard<mutex> guard(_lock);
+        _stopping = true;
+    }
+
+    _wake.notify_all();
+
+    for(auto& thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+int WorkerPool::size() const
+{
+    return _threads.size() + 1;
+}
+
+void WorkerPool::forEach(int count, const function<void(int)>& task)
+{
+    if(_threads.empty() || count <= 1)
+    {
+        runTasks(task, count);
+        return;
+    }
+
+    {
+        lock_guard<mutex> guard(_lock);
+        _task = &task;
+        _count = count;
+        _next = 0;
+        _finished = 0;
+        _generation++;
+    }
+
+    _wake.notify_all();
+    runTasks(task, count);
+
+    // every worker has to be done with task before it goes out of scope
+    unique_lock<mutex> guard(_lock);
+    _done.wait(guard, [this]() { return _finished == (int)_threads.size(); });
+}
+
+void WorkerPool::work()
+{
+    auto seen = uint64_t {0};
+    unique_lock<mutex> guard(_lock);
+
+    while(true)
+    {
+        _wake.wait(guard, [&]() { return _stopping || _generation != seen; });
+
+        if(_stopping)
+        {
+            return;
+        }
+
+        seen = _generation;
+        auto task = _task;
+        auto count = _count;
+
+        guard.unlock();
+        runTasks(*task, count);
+        guard.lock();
+
+        if(++_finished == (int)_threads.size())
+        {
+            _done.notify_one();
+        }
+    }
+}
+
+void WorkerPool::runTasks(const function<void(int)>& task, int count)
+{
+    if(_threads.empty() || count <= 1)
+    {
+        for(auto i = 0; i < count; i++)
+        {
+            task(i);
+        }
+
+        return;
+    }
+
+    for(auto i = _next++; i < count; i = _next++)
+    {
+        task(i);
+    }
+}
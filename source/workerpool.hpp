@@ -0,0 +1,48 @@
+#ifndef LAMCO_WORKERPOOL_HPP
+#define LAMCO_WORKERPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// A fixed set of threads for fork-join loops
+class WorkerPool
+{
+public:
+    // threads counts the calling thread, which works too
+    explicit WorkerPool(int threads);
+    ~WorkerPool();
+
+    int size() const;
+    // Calls task(i) for every i in [0, count) across the pool and returns
+    // once all calls are done. Tasks must not throw.
+    void forEach(int count, const function<void(int)>& task);
+
+private:
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+
+    void work();
+    void runTasks(const function<void(int)>& task, int count);
+
+    vector<thread> _threads;
+    mutex _lock;
+    condition_variable _wake;
+    condition_variable _done;
+    // the current loop, published under _lock
+    const function<void(int)>* _task;
+    int _count;
+    uint64_t _generation;
+    // workers finished with the current loop
+    int _finished;
+    bool _stopping;
+    atomic<int> _next;
+};
+
+#endif